@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+// Block encryption throughput, with the AES key expanded for every block (how DeviceEncryption used to work) and with
+// the keyed ciphers that DeviceEncryption reuses. Then flush-like batches of blocks encrypted one by one and
+// interleaved, and the same batches hashed with each supported SHA-1 kernel.
+
+#include <cryptopp/aes.h>
+#include <cryptopp/modes.h>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <wfslib/device.h>
+#include "device_encryption.h"
+#include "sha1.h"
+
+namespace {
+
+class NullDevice : public Device {
+ public:
+  void ReadSectors(const std::span<std::byte>&, uint32_t, uint32_t) override {}
+  void WriteSectors(const std::span<std::byte>&, uint32_t, uint32_t) override {}
+  uint32_t SectorsCount() const override { return 0x1000000; }
+  uint32_t Log2SectorSize() const override { return 9; }
+  bool IsReadOnly() const override { return false; }
+  void SetSectorsCount(uint32_t) override {}
+  void SetLog2SectorSize(uint32_t) override {}
+};
+
+// Processes about this much data for each measurement.
+constexpr size_t kBytesPerRun = 256 << 20;
+
+template <typename F>
+double MeasureThroughput(size_t block_size, F&& process_block) {
+  auto const blocks_count = kBytesPerRun / block_size;
+  auto const start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < blocks_count; ++i)
+    process_block(static_cast<uint32_t>(i));
+  std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<double>(blocks_count * block_size) / elapsed.count() / (1 << 20);
+}
+
+}  // namespace
+
+int main() {
+  const std::vector<std::byte> key(16, std::byte{0x5a});
+  DeviceEncryption encryption(std::make_shared<NullDevice>(), key);
+
+  std::printf("%-10s %-8s %16s %16s\n", "block", "op", "per-block key", "reused key");
+  for (size_t block_size : {size_t{4} << 10, size_t{8} << 10, size_t{512} << 10}) {
+    std::vector<std::byte> data(block_size, std::byte{0x33});
+    std::array<uint8_t, CryptoPP::AES::BLOCKSIZE> iv{};
+
+    auto const decrypt_per_block_key = MeasureThroughput(block_size, [&](uint32_t block_iv) {
+      iv[0] = static_cast<uint8_t>(block_iv);
+      CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryptor(reinterpret_cast<const uint8_t*>(key.data()), key.size(),
+                                                              iv.data());
+      decryptor.ProcessData(reinterpret_cast<uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(data.data()),
+                            data.size());
+    });
+    auto const decrypt_reused_key =
+        MeasureThroughput(block_size, [&](uint32_t block_iv) { encryption.DecryptBlock(data, block_iv); });
+    std::printf("%-10zu %-8s %11.1f MB/s %11.1f MB/s\n", block_size, "decrypt", decrypt_per_block_key,
+                decrypt_reused_key);
+
+    auto const encrypt_per_block_key = MeasureThroughput(block_size, [&](uint32_t block_iv) {
+      iv[0] = static_cast<uint8_t>(block_iv);
+      CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption encryptor(reinterpret_cast<const uint8_t*>(key.data()), key.size(),
+                                                              iv.data());
+      encryptor.ProcessData(reinterpret_cast<uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(data.data()),
+                            data.size());
+    });
+    auto const encrypt_reused_key =
+        MeasureThroughput(block_size, [&](uint32_t block_iv) { encryption.EncryptBlock(data, block_iv); });
+    std::printf("%-10zu %-8s %11.1f MB/s %11.1f MB/s\n", block_size, "encrypt", encrypt_per_block_key,
+                encrypt_reused_key);
+  }
+
+  constexpr size_t kBatchBlocksCount = 64;
+  std::printf("\n%-10s %-8s %16s %16s\n", "block", "op", "one by one", "interleaved");
+  for (size_t block_size : {size_t{4} << 10, size_t{8} << 10}) {
+    std::vector<std::byte> data(block_size * kBatchBlocksCount, std::byte{0x33});
+    std::vector<DeviceEncryption::BlockRef> blocks;
+    for (uint32_t i = 0; i < kBatchBlocksCount; ++i)
+      blocks.push_back({{data.data() + i * block_size, block_size}, i, /*previous_cipher_block=*/nullptr});
+
+    auto const one_by_one = MeasureThroughput(data.size(), [&](uint32_t) {
+      for (const auto& block : blocks)
+        encryption.EncryptBlock(block.data, block.iv);
+    });
+    auto const interleaved = MeasureThroughput(data.size(), [&](uint32_t) { encryption.EncryptBlocks(blocks); });
+    std::printf("%-10zu %-8s %11.1f MB/s %11.1f MB/s\n", block_size, "encrypt", one_by_one, interleaved);
+  }
+
+  std::printf("\n%-10s %-8s %16s\n", "block", "kernel", "sha1");
+  for (size_t block_size : {size_t{4} << 10, size_t{8} << 10}) {
+    std::vector<std::byte> data(block_size * kBatchBlocksCount, std::byte{0x33});
+    std::vector<std::array<std::byte, Sha1::DIGEST_SIZE>> digests(kBatchBlocksCount);
+    std::vector<Sha1::BlockHash> blocks;
+    for (size_t i = 0; i < kBatchBlocksCount; ++i)
+      blocks.push_back({{data.data() + i * block_size, block_size}, Sha1::kNoPlaceholder, digests[i]});
+
+    for (auto kernel : Sha1::SupportedKernels()) {
+      auto const throughput = MeasureThroughput(data.size(), [&](uint32_t) { Sha1::HashBlocks(blocks, kernel); });
+      std::printf("%-10zu %-8s %11.1f MB/s\n", block_size, kernel == Sha1::Kernel::Generic ? "generic" : "avx2-mb",
+                  throughput);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+// Key lookups in PTree nodes: a binary search that decodes one key at a time (how PTreeNode::find used to work), the
+// scalar linear scan and the SIMD kernel.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <ranges>
+#include <vector>
+
+#include "ptree_node_search.h"
+
+namespace {
+
+// Both are powers of two, with different sizes so every node is searched for different keys.
+constexpr size_t kNodesCount = 1 << 12;
+constexpr size_t kKeysCount = 1 << 14;
+constexpr size_t kLookupsPerRun = 64 << 20;
+
+template <has_keys T>
+struct TestNode {
+  T node;
+  size_t keys_count;
+};
+
+template <has_keys T>
+std::vector<TestNode<T>> MakeNodes(std::default_random_engine& rng) {
+  constexpr size_t kCapacity = node_keys_capacity<T>::value;
+  std::vector<TestNode<T>> nodes(kNodesCount);
+  for (auto& [node, keys_count] : nodes) {
+    keys_count = 1 + rng() % kCapacity;
+    std::vector<key_type> keys(keys_count);
+    for (auto& key : keys)
+      key = static_cast<key_type>(rng());
+    std::ranges::sort(keys);
+    node = {};
+    for (size_t i = 0; i < keys_count; ++i)
+      node_set_key(node, i, keys[i]);
+  }
+  return nodes;
+}
+
+template <has_keys T, typename F>
+double MeasureLookups(const std::vector<TestNode<T>>& nodes, const std::vector<key_type>& keys, F&& upper_bound) {
+  size_t checksum = 0;
+  auto const start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kLookupsPerRun; ++i) {
+    const auto& node = nodes[i & (kNodesCount - 1)];
+    checksum += upper_bound(node.node, node.keys_count, keys[i & (kKeysCount - 1)]);
+  }
+  std::chrono::duration<double, std::nano> const elapsed = std::chrono::steady_clock::now() - start;
+  // Keep the lookups from being optimized out.
+  if (checksum == 1)
+    std::printf(" ");
+  return elapsed.count() / kLookupsPerRun;
+}
+
+template <has_keys T>
+void BenchmarkNode(const char* name, std::default_random_engine& rng) {
+  auto const nodes = MakeNodes<T>(rng);
+  std::vector<key_type> keys(kKeysCount);
+  for (auto& key : keys)
+    key = static_cast<key_type>(rng());
+
+  auto const binary_search = MeasureLookups(nodes, keys, [](const T& node, size_t keys_count, key_type key) {
+    auto indexes = std::views::iota(size_t{0}, keys_count);
+    auto const it =
+        std::ranges::upper_bound(indexes, key, {}, [&node](size_t index) { return node_get_key(node, index); });
+    return static_cast<size_t>(it - indexes.begin());
+  });
+  auto const scalar = MeasureLookups(nodes, keys, [](const T& node, size_t keys_count, key_type key) {
+    return node_keys_upper_bound_scalar(node, keys_count, key);
+  });
+  std::printf("%-20s %10.2f ns %10.2f ns", name, binary_search, scalar);
+#ifdef WFSLIB_PTREE_NODE_SEARCH_SIMD
+  auto const simd = MeasureLookups(nodes, keys, [](const T& node, size_t keys_count, key_type key) {
+    return node_keys_upper_bound_simd(node, keys_count, key);
+  });
+  std::printf(" %10.2f ns", simd);
+#endif
+  std::printf("\n");
+}
+
+}  // namespace
+
+int main() {
+  std::default_random_engine rng{1};
+  std::printf("%-20s %13s %13s %13s\n", "node", "binary search", "scalar", "simd");
+  BenchmarkNode<PTreeNode_details>("PTreeNode_details", rng);
+  BenchmarkNode<RTreeLeaf_details>("RTreeLeaf_details", rng);
+  BenchmarkNode<FTreeLeaf_details>("FTreeLeaf_details", rng);
+  return 0;
+}
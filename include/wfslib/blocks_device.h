@@ -7,13 +7,30 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <span>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "aligned_allocator.h"
+#include "device.h"
 #include "device_encryption.h"
+#include "retained_blocks_cache.h"
+#include "verified_blocks.h"
 
 class Block;
 
@@ -22,8 +39,50 @@ class DeviceEncryption;
 
 class BlocksDevice {
  public:
+  struct BlockExtent {
+    uint32_t block_number;
+    uint32_t data_size;
+  };
+
+  struct BlockRead {
+    uint32_t block_number;
+    std::span<std::byte> data;
+    std::span<const std::byte> hash;
+    uint32_t iv;
+    bool encrypt;
+    bool check_hash;
+  };
+
+  struct BlockWrite {
+    uint32_t block_number;
+    std::span<std::byte> data;
+    std::span<std::byte> hash;
+    uint32_t iv;
+    bool encrypt;
+    bool recalculate_hash;
+    // Offset of the first modified byte. The sectors before it are already on the device, only the rest is written.
+    uint32_t dirty_offset;
+  };
+
+  struct CachedBlock {
+    std::shared_ptr<Block> block;
+    // Set if the block was added by this lookup. The caller then loads it and calls SetLoaded.
+    bool added;
+    // Set if the thread that added the block failed to load it.
+    bool bad_hash;
+  };
+
+  struct WritebackOptions {
+    // Released dirty blocks are written after at most this long.
+    std::chrono::milliseconds max_age{5000};
+    // They are written right away once they add up to this size.
+    size_t background_bytes{4 << 20};
+    // Releasing a dirty block waits for the writeback while they add up to more than this size.
+    size_t limit_bytes{64 << 20};
+  };
+
   BlocksDevice(std::shared_ptr<Device> device, std::optional<std::vector<std::byte>> key = std::nullopt);
-  virtual ~BlocksDevice() = default;
+  virtual ~BlocksDevice();
 
   virtual void WriteBlock(uint32_t block_number,
                           uint32_t size_in_blocks,
@@ -31,7 +90,14 @@ class BlocksDevice {
                           const std::span<std::byte>& hash,
                           uint32_t iv,
                           bool encrypt,
-                          bool recalculate_hash);
+                          bool recalculate_hash,
+                          uint32_t dirty_offset = 0);
+  // Writes several blocks at once. They are sorted by their physical address, each block is encrypted with its own iv
+  // to a staging buffer, and physically contiguous blocks are written with a single device range. Hashes that are
+  // stored outside of their block are calculated before the in-block hashes, so a metadata block that stores the hash
+  // of a data block in the same batch is hashed with it. A block is written from the sector of its dirty offset, with
+  // its encryption chained to the last cipher block of the sector before it, which is read back from the device.
+  virtual void WriteBlocks(std::span<const BlockWrite> blocks);
   virtual bool ReadBlock(uint32_t block_number,
                          uint32_t size_in_blocks,
                          const std::span<std::byte>& data,
@@ -39,18 +105,216 @@ class BlocksDevice {
                          uint32_t iv,
                          bool encrypt,
                          bool check_hash);
+  // Reads several blocks at once. They are sorted by their physical address, and physically contiguous blocks are read
+  // with a single device range, then each block is decrypted and verified with its own iv. Returns the hash check
+  // result of each block, in the order of the requests.
+  virtual std::vector<bool> ReadBlocks(std::span<const BlockRead> blocks);
+  // Reads |data.size()| bytes from |offset| of a block of |block_size| bytes without reading all of it. Only the
+  // sectors that cover the range are read and decrypted, with the sector before them that their encryption is chained
+  // to. The hash of the block isn't checked.
+  virtual void ReadBlockRange(uint32_t block_number,
+                              uint32_t block_size,
+                              uint32_t offset,
+                              const std::span<std::byte>& data,
+                              uint32_t iv,
+                              bool encrypt);
+  // View of the block straight from the device memory when it can be used as is, without decryption. Returns an empty
+  // span if the block has to be read with ReadBlock.
+  virtual std::span<const std::byte> GetBlockView(uint32_t block_number, uint32_t size, bool encrypt) const;
+
+  // Reads the raw sectors of several blocks with a single device batch, so the device can have all of them in flight at
+  // once. The next ReadBlock of each of these blocks is served from the prefetched sectors. Reads up to
+  // kMaxPrefetchBytes and ignores the blocks after them, so long reads should be prefetched window by window as they
+  // advance.
+  void PrefetchBlocks(std::span<const BlockExtent> blocks);
+  static constexpr size_t kMaxPrefetchBytes = 4 << 20;
+
+  // Read-ahead window in physical blocks. When ReadBlock is called for physically sequential blocks, the sectors of the
+  // next window are read in the background. 0 (the default) disables it. Waits for the reads that are in flight.
+  void SetReadAheadWindow(uint32_t blocks_count);
+
+  // Byte budget for keeping the data of released clean blocks, so loading them again doesn't read, decrypt and verify
+  // them again. 0 (the default) disables it.
+  void SetRetainedCacheBudget(size_t bytes);
+  size_t RetainedCacheSize() const;
+  // Called by blocks when they are released, and when they are loaded.
+  void RetainBlock(uint32_t block_number, RetainedBlocksCache::Entry entry, bool reused);
+  std::optional<RetainedBlocksCache::Entry> TakeRetainedBlock(uint32_t block_number);
+
+  // Number of blocks whose hash is remembered once they are verified, until they are written. Reading them again, from
+  // the device or from its memory view, then doesn't hash them again. 0 (the default) disables it.
+  void SetVerifiedBlocksCapacity(size_t blocks_count);
+  // Checks the hash of a block that was read, unless it was already verified against the same hash since it was last
+  // written.
+  bool CheckBlockHash(uint32_t block_number,
+                      std::span<const std::byte> data,
+                      std::span<const std::byte> hash,
+                      uint32_t iv,
+                      bool encrypt);
 
   const Device* device() const { return device_.get(); }
 
+  // The blocks cache can be used from several threads. A block that is being loaded by another thread is waited for, so
+  // only one thread reads it.
   std::shared_ptr<Block> GetFromCache(uint32_t block_number);
-  void AddToCache(uint32_t block_number, std::weak_ptr<Block> block);
-  void RemoveFromCache(uint32_t block_number);
+  // Looks up the block, or adds the block that |create| returns if it isn't cached. |create| may be null to only look
+  // it up. Without |wait|, returns a null block instead of waiting for a block that is being loaded by another thread.
+  CachedBlock GetOrAddToCache(uint32_t block_number,
+                              const std::function<std::shared_ptr<Block>()>& create,
+                              bool wait = true);
+  // Adds a block that is already loaded.
+  void AddToCache(uint32_t block_number, const std::shared_ptr<Block>& block);
+  // Wakes up the threads that wait for a block that was added with GetOrAddToCache.
+  void SetLoaded(uint32_t block_number, const Block* block, bool loaded);
+  // Removes the block only if it is still the cached block of this number.
+  void RemoveFromCache(uint32_t block_number, const Block* block);
+  // Called by blocks when they become dirty, and when they are flushed or detached.
+  void AddDirtyBlock(Block* block);
+  void RemoveDirtyBlock(Block* block);
+  // Flushes the dirty blocks and waits for the writeback. Throws the error of a failed background write.
   void FlushAll();
 
+  // Starts a thread that encrypts and writes the dirty blocks that are released, so the thread that releases them only
+  // calculates their hash. Blocks that are still referenced are flushed by their owners or by FlushAll as usual.
+  void StartWriteback(WritebackOptions options);
+  // Writes what is left and stops the thread.
+  void StopWriteback();
+  bool writeback_enabled() const { return writeback_enabled_; }
+  // Called by dirty blocks that are released while the writeback is enabled, with their hash already calculated.
+  void QueueWrite(uint32_t block_number, BlockBuffer data, uint32_t iv, bool encrypt, uint32_t dirty_offset = 0);
+
  private:
+  struct ReadAheadWindow {
+    uint32_t first_block;
+    uint32_t blocks_count;
+    // Owned by the read too, so a window can be dropped while its read is in flight.
+    std::shared_ptr<AlignedBuffer> data;
+    // Whether the sectors were read successfully.
+    std::shared_future<bool> loaded;
+  };
+
+  struct PrefetchedBlock {
+    AlignedBuffer data;
+    std::list<uint32_t>::iterator position;
+  };
+
+  struct CacheEntry {
+    const Block* block;
+    std::weak_ptr<Block> ref;
+    std::optional<bool> loaded;
+  };
+
+  // The blocks cache is split to shards by block number, each with its own lock.
+  struct CacheShard {
+    std::mutex lock;
+    // Notified when a block finishes loading or is removed.
+    std::condition_variable changed;
+    std::unordered_map<uint32_t, CacheEntry> blocks;
+  };
+  static constexpr size_t kCacheShardsCount = 16;
+
+  // Prefetched blocks that weren't read yet are kept up to this size, the oldest ones are dropped first. Several
+  // readers may prefetch at the same time.
+  static constexpr size_t kMaxPrefetchedBytes = 4 * kMaxPrefetchBytes;
+
+  // Encrypted blocks of at least this size are decrypted and checked in a single pass when read in a batch, smaller
+  // ones stay in the cache between the passes anyway and are hashed together instead.
+  static constexpr size_t kMinFusedDecryptSize = 64 * 1024;
+
+  struct PendingWrite {
+    BlockBuffer data;
+    uint32_t iv;
+    bool encrypt;
+    uint32_t dirty_offset;
+  };
+
+  struct RawBlock {
+    uint32_t block_number;
+    std::span<std::byte> data;
+  };
+
   uint32_t ToDeviceSector(uint32_t block_number) const;
+  void WriteBlocksToDevice(std::span<const BlockWrite> blocks);
+  // Copies the data of a block that is waiting for the writeback. Returns false if there is none.
+  bool ReadPendingWrite(uint32_t block_number, const std::span<std::byte>& data) const;
+  // Same, for |data.size()| bytes from |offset| of a block of |block_size| bytes.
+  bool ReadPendingWrite(uint32_t block_number,
+                        uint32_t block_size,
+                        uint32_t offset,
+                        const std::span<std::byte>& data) const;
+  // Drops the pending writes that overlap a newer write, the newer write must then be written whole. Returns false if
+  // there were none. Must be called with writeback_io_lock_.
+  bool CancelPendingWrites(uint32_t block_number, uint32_t blocks_count);
+  void WritePendingWrites();
+  void WritebackThread();
+  CacheShard& GetCacheShard(uint32_t block_number) { return cache_shards_[block_number % kCacheShardsCount]; }
+  // Reads the raw sectors of the blocks with a single device batch, merging physically contiguous blocks.
+  void ReadRawBlocks(std::vector<RawBlock> blocks);
+  // Zero-fills the ranges that are holes in the device instead of reading them, and removes them from the list.
+  void SkipHoles(std::vector<Device::SectorsRange>& ranges) const;
+  // The functions below must be called with state_lock_.
+  bool TakePrefetchedBlock(uint32_t block_number, const std::span<std::byte>& data);
+  void ErasePrefetchedBlock(std::unordered_map<uint32_t, PrefetchedBlock>::iterator it);
+  // Copies the block from a read-ahead window, waiting for its read without state_lock_.
+  bool TakeReadAhead(uint32_t block_number, const std::span<std::byte>& data);
+  // The functions below must be called with state_lock_. The windows that they drop are moved to |dropped|, to be freed
+  // after it is released.
+  void UpdateReadAhead(uint32_t block_number, uint32_t blocks_count, std::vector<ReadAheadWindow>& dropped);
+  void LaunchReadAhead(uint32_t first_block);
+  void DropReadAhead(uint32_t block_number, uint32_t blocks_count, std::vector<ReadAheadWindow>& dropped);
+  // Whether the block was verified with these parameters since it was last written, so it may not have to be hashed.
+  bool MaybeVerified(uint32_t block_number, size_t size, uint32_t iv, bool encrypt) const;
+  // Whether the block was verified against this hash since it was last written.
+  bool IsVerified(uint32_t block_number,
+                  std::span<const std::byte> data,
+                  std::span<const std::byte> hash,
+                  uint32_t iv,
+                  bool encrypt) const;
+  void SetVerified(uint32_t block_number,
+                   std::span<const std::byte> data,
+                   std::span<const std::byte> hash,
+                   uint32_t iv,
+                   bool encrypt);
 
   std::shared_ptr<Device> device_;
   std::unique_ptr<DeviceEncryption> device_encryption_;
-  std::unordered_map<uint32_t, std::weak_ptr<Block>> blocks_cache_;
+  std::array<CacheShard, kCacheShardsCount> cache_shards_;
+
+  // Writes from the writeback thread and from other threads are serialized, so a newer write of a block can't be
+  // overwritten by an older pending write.
+  std::mutex writeback_io_lock_;
+  // Protects the pending writes and the writeback state.
+  mutable std::mutex writeback_lock_;
+  std::condition_variable writeback_changed_;
+  std::map<uint32_t, std::shared_ptr<PendingWrite>> pending_writes_;
+  size_t pending_bytes_{0};
+  std::chrono::steady_clock::time_point oldest_pending_write_;
+  WritebackOptions writeback_options_;
+  std::atomic<bool> writeback_enabled_{false};
+  bool stop_writeback_{false};
+  std::exception_ptr writeback_error_;
+  std::thread writeback_thread_;
+
+  std::mutex dirty_blocks_lock_;
+  // Head of the intrusive list of the dirty blocks, linked through the blocks.
+  Block* dirty_blocks_{nullptr};
+
+  // Protects the prefetched blocks, the retained blocks, the verified blocks and the read-ahead state.
+  mutable std::mutex state_lock_;
+  // Raw sectors of the prefetched blocks that weren't read yet.
+  std::unordered_map<uint32_t, PrefetchedBlock> prefetched_blocks_;
+  // Oldest first.
+  std::list<uint32_t> prefetched_order_;
+  size_t prefetched_bytes_{0};
+  RetainedBlocksCache retained_blocks_;
+  VerifiedBlocks verified_blocks_;
+
+  uint32_t read_ahead_window_{0};
+  uint32_t next_sequential_block_{0};
+  uint32_t sequential_reads_{0};
+  // The window that is being read and the one after it.
+  std::deque<ReadAheadWindow> read_ahead_;
+  // Read-ahead reads that are in flight, including the ones of dropped windows.
+  uint32_t read_ahead_reads_{0};
+  std::condition_variable read_ahead_done_;
 };
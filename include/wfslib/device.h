@@ -9,16 +9,48 @@
 
 #include <cstdint>
 #include <span>
+#include <vector>
 
 class Device {
  public:
+  struct SectorsRange {
+    std::span<std::byte> data;
+    uint32_t sector_address;
+  };
+  struct SectorsExtent {
+    uint32_t sector_address;
+    uint32_t sectors_count;
+  };
+
   virtual ~Device() {}
   virtual void ReadSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) = 0;
   virtual void WriteSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) = 0;
+  // Transfer a batch of independent sector ranges, which may be completed in any order. Devices that can have several
+  // requests in flight should override these.
+  virtual void ReadSectorsBatch(std::span<const SectorsRange> ranges) {
+    for (const auto& range : ranges)
+      ReadSectors(range.data, range.sector_address, static_cast<uint32_t>(range.data.size() >> Log2SectorSize()));
+  }
+  virtual void WriteSectorsBatch(std::span<const SectorsRange> ranges) {
+    for (const auto& range : ranges)
+      WriteSectors(range.data, range.sector_address, static_cast<uint32_t>(range.data.size() >> Log2SectorSize()));
+  }
   virtual uint32_t SectorsCount() const = 0;
   virtual uint32_t Log2SectorSize() const = 0;
   virtual bool IsReadOnly() const = 0;
   uint32_t SectorSize() const { return 1 << Log2SectorSize(); }
   virtual void SetSectorsCount(uint32_t sectors_count) = 0;
   virtual void SetLog2SectorSize(uint32_t log2_sector_size) = 0;
+
+  // Read-only view of the sectors in memory, valid for the lifetime of the device. Devices that can't provide one
+  // return an empty span, and the sectors should be read with ReadSectors.
+  virtual std::span<const std::byte> SectorsView(uint32_t /*sector_address*/, uint32_t /*sectors_count*/) const {
+    return {};
+  }
+
+  // The parts of the given sectors that may hold data, sorted. Sectors outside of them are holes in the backing storage
+  // and read as zeros, so bulk readers can skip them. Devices that can't tell return the whole range.
+  virtual std::vector<SectorsExtent> DataExtents(uint32_t sector_address, uint32_t sectors_count) const {
+    return {{sector_address, sectors_count}};
+  }
 };
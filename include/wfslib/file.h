@@ -11,6 +11,7 @@
 #include <boost/iostreams/positioning.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <memory>
+#include <set>
 #include "entry.h"
 
 class QuotaArea;
@@ -38,18 +39,27 @@ class File : public Entry, public std::enable_shared_from_this<File> {
    public:
     typedef char char_type;
     struct category : public boost::iostreams::seekable_device_tag, public boost::iostreams::optimally_buffered_tag {};
-    file_device(const std::shared_ptr<File>& file);
+    // With |range_reads|, small reads from large data blocks read and decrypt only the sectors that they need instead
+    // of loading the whole block, and the hash check of these blocks is deferred to VerifyRangeReads.
+    file_device(const std::shared_ptr<File>& file, bool range_reads = false);
 
     std::streamsize read(char_type* s, std::streamsize n);
     std::streamsize write(const char_type* s, std::streamsize n);
     boost::iostreams::stream_offset seek(boost::iostreams::stream_offset off, std::ios_base::seekdir way);
     std::streamsize optimal_buffer_size() const;
 
+    // Checks the hashes of the data blocks that were read by range so far, by loading them. Throws like a regular read
+    // if one of them is corrupted.
+    void VerifyRangeReads();
+
    private:
     size_t size() const;
 
     std::shared_ptr<File> file_;
     boost::iostreams::stream_offset pos_;
+    bool range_reads_;
+    // Offsets in the file of the data blocks that were read by range and weren't verified yet.
+    std::set<size_t> unverified_blocks_;
   };
 
   typedef boost::iostreams::stream<file_device> stream;
@@ -13,15 +13,35 @@
 #include <mutex>
 #include "device.h"
 
+class NativeFile;
+
 class FileDevice : public Device {
  public:
+  enum class IoMode {
+    // Buffered std::fstream, all I/O is serialized behind a single lock.
+    Stream,
+    // Positional reads/writes on the native file handle, concurrent I/O doesn't share any seek state.
+    Positional,
+    // Positional I/O that bypasses the host page cache (O_DIRECT, F_NOCACHE on macOS, FILE_FLAG_NO_BUFFERING on
+    // Windows), so blocks are only cached once, by the library. Block buffers are allocated aligned for it, other
+    // buffers are copied through an aligned buffer. The host sector size must divide the device sector size.
+    Direct,
+  };
+
   FileDevice(const std::filesystem::path& path,
              uint32_t log2_sector_size = 9 /* 512 */,
              uint32_t sectors_count = 0,
              bool read_only = true,
-             bool open_create = false);
+             bool open_create = false,
+             IoMode io_mode = IoMode::Stream);
+  ~FileDevice() override;
+
   void ReadSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) override;
   void WriteSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) override;
+  // Adjacent ranges are merged, each run of them is transferred with a single vectored call (or a single seek in stream
+  // mode).
+  void ReadSectorsBatch(std::span<const SectorsRange> ranges) override;
+  void WriteSectorsBatch(std::span<const SectorsRange> ranges) override;
   uint32_t SectorsCount() const override { return sectors_count_; }
   uint32_t Log2SectorSize() const override { return log2_sector_size_; }
   bool IsReadOnly() const override { return read_only_; }
@@ -29,11 +49,19 @@ class FileDevice : public Device {
   void SetSectorsCount(uint32_t sectors_count) override { sectors_count_ = sectors_count; }
   void SetLog2SectorSize(uint32_t log2_sector_size) override { log2_sector_size_ = log2_sector_size; }
 
+  std::vector<SectorsExtent> DataExtents(uint32_t sector_address, uint32_t sectors_count) const override;
+
   uint64_t GetFileSize();
 
+  IoMode io_mode() const { return io_mode_; }
+
  private:
+  void CheckBatchBounds(std::span<const SectorsRange> ranges, const char* error) const;
+
+  IoMode io_mode_;
   std::unique_ptr<std::iostream> file_;
   std::mutex io_lock_;
+  std::unique_ptr<NativeFile> native_file_;
 
   uint32_t log2_sector_size_;
   uint32_t sectors_count_;
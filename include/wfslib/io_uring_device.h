@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include "device.h"
+
+class NativeFile;
+
+// Linux only. Device that submits sector batches to io_uring, so all the requests of a batch are in flight at the same
+// time and are completed in any order.
+class IoUringDevice : public Device {
+ public:
+  // Throws if the image can't be opened or if io_uring isn't available on this system.
+  IoUringDevice(const std::filesystem::path& path,
+                uint32_t log2_sector_size = 9 /* 512 */,
+                uint32_t sectors_count = 0,
+                bool read_only = true,
+                bool open_create = false,
+                uint32_t queue_depth = 64);
+  ~IoUringDevice() override;
+
+  void ReadSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) override;
+  void WriteSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) override;
+  void ReadSectorsBatch(std::span<const SectorsRange> ranges) override;
+  void WriteSectorsBatch(std::span<const SectorsRange> ranges) override;
+  uint32_t SectorsCount() const override { return sectors_count_; }
+  uint32_t Log2SectorSize() const override { return log2_sector_size_; }
+  bool IsReadOnly() const override { return read_only_; }
+
+  void SetSectorsCount(uint32_t sectors_count) override { sectors_count_ = sectors_count; }
+  void SetLog2SectorSize(uint32_t log2_sector_size) override { log2_sector_size_ = log2_sector_size; }
+
+  std::vector<SectorsExtent> DataExtents(uint32_t sector_address, uint32_t sectors_count) const override;
+
+  uint64_t GetFileSize();
+
+ private:
+  class Ring;
+  struct Batch;
+
+  void Submit(std::span<const SectorsRange> ranges, bool write);
+  // Pops the completions of all the batches and updates their requests. Must be called with ring_lock_.
+  void ReapCompletions();
+
+  std::unique_ptr<NativeFile> file_;
+  std::unique_ptr<Ring> ring_;
+  // Protects the queues of the ring and the state below. Only held while queuing and reaping, not while waiting for
+  // the kernel, so several batches can be in flight together.
+  std::mutex ring_lock_;
+  std::condition_variable completions_;
+  // Entries in flight, of all the batches.
+  uint32_t in_flight_{0};
+  // Whether a thread waits for completions in the kernel. The rest wait for it to reap them.
+  bool waiting_{false};
+
+  uint32_t log2_sector_size_;
+  uint32_t sectors_count_;
+  bool read_only_;
+};
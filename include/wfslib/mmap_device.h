@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include "device.h"
+
+class NativeFile;
+
+// Device backed by a memory mapping of the image file. Sectors that don't need to be decrypted are handed to blocks as
+// views into the mapping instead of being copied.
+class MmapDevice : public Device {
+ public:
+  // The mapping covers the file, or sectors_count sectors if the device is writable and the file is shorter (the file
+  // is extended).
+  MmapDevice(const std::filesystem::path& path,
+             uint32_t log2_sector_size = 9 /* 512 */,
+             uint32_t sectors_count = 0,
+             bool read_only = true,
+             bool open_create = false);
+  ~MmapDevice() override;
+
+  void ReadSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) override;
+  void WriteSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) override;
+  uint32_t SectorsCount() const override { return sectors_count_; }
+  uint32_t Log2SectorSize() const override { return log2_sector_size_; }
+  bool IsReadOnly() const override { return read_only_; }
+
+  // Extends the file and maps it again if the device is writable and grows beyond the mapping. The views that were
+  // taken before are invalid then.
+  void SetSectorsCount(uint32_t sectors_count) override;
+  void SetLog2SectorSize(uint32_t log2_sector_size) override { log2_sector_size_ = log2_sector_size; }
+
+  std::span<const std::byte> SectorsView(uint32_t sector_address, uint32_t sectors_count) const override;
+
+  uint64_t GetFileSize();
+
+ private:
+  void MapFile();
+  std::span<std::byte> GetSectors(uint32_t sector_address, uint32_t sectors_count) const;
+
+  std::unique_ptr<NativeFile> file_;
+  std::span<std::byte> mapping_;
+
+  uint32_t log2_sector_size_;
+  uint32_t sectors_count_;
+  bool read_only_;
+};
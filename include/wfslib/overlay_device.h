@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <boost/dynamic_bitset.hpp>
+#include <filesystem>
+#include <memory>
+#include <shared_mutex>
+#include "device.h"
+
+class NativeFile;
+
+// Copy-on-write layer over a base device. Written sectors go to a sparse delta file, at the same offset as in the base
+// device, and an in-memory map tracks which sectors were overlaid. The base device isn't modified until Commit.
+class OverlayDevice : public Device {
+ public:
+  // The delta file is created if needed, and its previous content is discarded.
+  OverlayDevice(std::shared_ptr<Device> base, const std::filesystem::path& delta_path);
+  ~OverlayDevice() override;
+
+  void ReadSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) override;
+  void WriteSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) override;
+  uint32_t SectorsCount() const override { return base_->SectorsCount(); }
+  uint32_t Log2SectorSize() const override { return base_->Log2SectorSize(); }
+  bool IsReadOnly() const override { return false; }
+
+  void SetSectorsCount(uint32_t sectors_count) override { base_->SetSectorsCount(sectors_count); }
+  void SetLog2SectorSize(uint32_t log2_sector_size) override { base_->SetLog2SectorSize(log2_sector_size); }
+
+  // Writes the overlaid sectors to the base device, and then discards them. The base device must be writable.
+  void Commit();
+  // Drops all the writes since the last commit.
+  void Discard();
+
+  size_t OverlaidSectorsCount() const;
+
+  const std::shared_ptr<Device>& base() const { return base_; }
+
+ private:
+  bool IsOverlaid(uint32_t sector_address) const {
+    return sector_address < overlaid_sectors_.size() && overlaid_sectors_.test(sector_address);
+  }
+  void DiscardLocked();
+
+  std::shared_ptr<Device> base_;
+  std::unique_ptr<NativeFile> delta_;
+
+  mutable std::shared_mutex lock_;
+  boost::dynamic_bitset<> overlaid_sectors_;
+};
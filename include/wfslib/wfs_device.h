@@ -10,6 +10,7 @@
 #include <expected>
 #include <memory>
 #include <optional>
+#include <span>
 #include <string_view>
 #include <vector>
 
@@ -49,6 +50,11 @@ class WfsDevice : public std::enable_shared_from_this<WfsDevice> {
                                                                     uint32_t physical_block_number,
                                                                     BlockSize block_size,
                                                                     bool new_block = false) const;
+  // Loads several metadata blocks, the ones that aren't cached are read together.
+  std::expected<std::vector<std::shared_ptr<Block>>, WfsError> LoadMetadataBlocks(
+      const Area* area,
+      std::span<const uint32_t> physical_block_numbers,
+      BlockSize block_size) const;
   std::expected<std::shared_ptr<Block>, WfsError> LoadDataBlock(const Area* area,
                                                                 uint32_t physical_block_number,
                                                                 BlockSize block_size,
@@ -57,6 +63,13 @@ class WfsDevice : public std::enable_shared_from_this<WfsDevice> {
                                                                 Block::HashRef data_hash,
                                                                 bool encrypted,
                                                                 bool new_block = false) const;
+  // See Block::ReadDataBlockRange.
+  std::expected<bool, WfsError> ReadDataBlockRange(const Area* area,
+                                                   uint32_t physical_block_number,
+                                                   uint32_t data_size,
+                                                   bool encrypted,
+                                                   size_t offset,
+                                                   std::span<std::byte> output) const;
 
   static std::expected<std::shared_ptr<WfsDevice>, WfsError> Open(
       std::shared_ptr<Device> device,
@@ -12,8 +12,13 @@
 #include "errors.h"
 #include "file.h"
 #include "file_device.h"
+#ifdef __linux__
+#include "io_uring_device.h"
+#endif
 #include "key_file.h"
 #include "link.h"
+#include "mmap_device.h"
+#include "overlay_device.h"
 #include "recovery.h"
 #include "wfs_device.h"
 
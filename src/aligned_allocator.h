@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Buffer alignment that is enough for unbuffered I/O on any host (a page, and a multiple of every logical sector size).
+// Transfer sizes and offsets only need to be multiples of the host sector size, which WFS sectors always are.
+constexpr size_t kDirectIoAlignment = 4096;
+
+// Resizing with no value doesn't zero-fill the new elements, for buffers that are about to be read into.
+template <typename T, size_t Alignment>
+class AlignedAllocator {
+ public:
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+  T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{Alignment})); }
+  void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t{Alignment}); }
+
+  template <typename U>
+  void construct(U* p) noexcept(std::is_nothrow_default_constructible_v<U>) {
+    ::new (static_cast<void*>(p)) U;
+  }
+  template <typename U, typename... Args>
+  void construct(U* p, Args&&... args) {
+    std::construct_at(p, std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Alignment>&) const {
+    return true;
+  }
+};
+
+// Buffer that can be handed as is to a device opened for direct I/O.
+using AlignedBuffer = std::vector<std::byte, AlignedAllocator<std::byte, kDirectIoAlignment>>;
+
+inline bool IsDirectIoAligned(const void* data) {
+  return reinterpret_cast<uintptr_t>(data) % kDirectIoAlignment == 0;
+}
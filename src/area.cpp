@@ -8,6 +8,7 @@
 #include "area.h"
 
 #include <random>
+#include <vector>
 
 #include "wfs_device.h"
 
@@ -55,6 +56,15 @@ std::expected<std::shared_ptr<Block>, WfsError> Area::LoadMetadataBlock(uint32_t
   return wfs_device_->LoadMetadataBlock(this, to_physical_block_number(area_block_number), block_size, new_block);
 }
 
+std::expected<std::vector<std::shared_ptr<Block>>, WfsError> Area::LoadMetadataBlocks(
+    std::span<const uint32_t> area_block_numbers) const {
+  std::vector<uint32_t> physical_block_numbers;
+  physical_block_numbers.reserve(area_block_numbers.size());
+  for (auto area_block_number : area_block_numbers)
+    physical_block_numbers.push_back(to_physical_block_number(area_block_number));
+  return wfs_device_->LoadMetadataBlocks(this, physical_block_numbers, static_cast<BlockSize>(block_size_log2()));
+}
+
 std::expected<std::shared_ptr<Block>, WfsError> Area::LoadDataBlock(uint32_t area_block_number,
                                                                     BlockSize block_size,
                                                                     BlockType block_type,
@@ -65,3 +75,28 @@ std::expected<std::shared_ptr<Block>, WfsError> Area::LoadDataBlock(uint32_t are
   return wfs_device_->LoadDataBlock(this, to_physical_block_number(area_block_number), block_size, block_type,
                                     data_size, std::move(data_hash), encrypted, new_block);
 }
+
+std::expected<bool, WfsError> Area::ReadDataBlockRange(uint32_t area_block_number,
+                                                       uint32_t data_size,
+                                                       bool encrypted,
+                                                       size_t offset,
+                                                       std::span<std::byte> output) const {
+  return wfs_device_->ReadDataBlockRange(this, to_physical_block_number(area_block_number), data_size, encrypted,
+                                         offset, output);
+}
+
+void Area::PrefetchDataBlocks(std::span<const BlocksDevice::BlockExtent> blocks) const {
+  std::vector<BlocksDevice::BlockExtent> physical_blocks;
+  physical_blocks.reserve(blocks.size());
+  for (const auto& block : blocks)
+    physical_blocks.push_back({to_physical_block_number(block.block_number), block.data_size});
+  wfs_device_->device()->PrefetchBlocks(physical_blocks);
+}
+
+void Area::PrefetchMetadataBlocks(std::span<const uint32_t> area_block_numbers) const {
+  std::vector<BlocksDevice::BlockExtent> physical_blocks;
+  physical_blocks.reserve(area_block_numbers.size());
+  for (auto area_block_number : area_block_numbers)
+    physical_blocks.push_back({to_physical_block_number(area_block_number), uint32_t{1} << block_size_log2()});
+  wfs_device_->device()->PrefetchBlocks(physical_blocks);
+}
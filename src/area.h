@@ -10,6 +10,7 @@
 #include <memory>
 
 #include "block.h"
+#include "blocks_device.h"
 #include "structs.h"
 
 class WfsDevice;
@@ -29,6 +30,8 @@ class Area {
   std::expected<std::shared_ptr<Block>, WfsError> LoadMetadataBlock(uint32_t area_block_number,
                                                                     BlockSize block_size,
                                                                     bool new_block = false) const;
+  std::expected<std::vector<std::shared_ptr<Block>>, WfsError> LoadMetadataBlocks(
+      std::span<const uint32_t> area_block_numbers) const;
   std::expected<std::shared_ptr<Block>, WfsError> LoadDataBlock(uint32_t area_block_number,
                                                                 BlockSize block_size,
                                                                 BlockType block_type,
@@ -36,6 +39,16 @@ class Area {
                                                                 Block::HashRef data_hash,
                                                                 bool encrypted,
                                                                 bool new_block = false) const;
+  // Reads part of a data block without loading it, see Block::ReadDataBlockRange.
+  std::expected<bool, WfsError> ReadDataBlockRange(uint32_t area_block_number,
+                                                   uint32_t data_size,
+                                                   bool encrypted,
+                                                   size_t offset,
+                                                   std::span<std::byte> output) const;
+  // Let the device read ahead the sectors of data blocks (by area block number) that are about to be loaded.
+  void PrefetchDataBlocks(std::span<const BlocksDevice::BlockExtent> blocks) const;
+  // Same, for metadata blocks.
+  void PrefetchMetadataBlocks(std::span<const uint32_t> area_block_numbers) const;
 
   uint32_t to_area_block_number(uint32_t physical_block_number) const {
     return to_area_blocks_count(physical_block_number - header_block_->physical_block_number());
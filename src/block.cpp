@@ -21,7 +21,8 @@ Block::Block(std::shared_ptr<BlocksDevice> device,
              uint32_t data_size,
              uint32_t iv,
              HashRef hash_ref,
-             bool encrypted)
+             bool encrypted,
+             bool zero_fill)
     : device_(std::move(device)),
       physical_block_number_(physical_block_number),
       block_size_(block_size),
@@ -30,7 +31,11 @@ Block::Block(std::shared_ptr<BlocksDevice> device,
       iv_(iv),
       encrypted_(encrypted),
       hash_ref_(std::move(hash_ref)),
-      data_{GetAlignedSize(data_size_), std::byte{0}} {}
+      data_(GetAlignedSize(data_size_)) {
+  // Not needed if the whole buffer is about to be fetched.
+  if (zero_fill)
+    std::ranges::fill(data_, std::byte{0});
+}
 
 Block::Block(std::vector<std::byte> data)
     : physical_block_number_(0),
@@ -41,10 +46,12 @@ Block::Block(std::vector<std::byte> data)
       encrypted_(false),
       detached_(true),
       hash_ref_{},
-      data_(std::move(data)) {}
+      data_(data.begin(), data.end()) {}
 
 Block::~Block() {
-  Flush();
+  if (!QueueWriteback())
+    Flush();
+  RetainData();
   Detach();
 }
 
@@ -54,42 +61,179 @@ void Block::Resize(uint32_t data_size) {
   if (data_size_ == data_size)
     return;
 
+  UnmapData();
   if (data_size > data_size_)
     std::ranges::fill(data_.begin() + data_size_, data_.begin() + std::min<size_t>(data_size, data_.size()),
                       std::byte{0});
 
   auto new_size = GetAlignedSize(data_size);
+  // The size of the block is part of its iv, so all of it is encrypted differently when the sectors count changes.
+  SetDirty(new_size != data_.size() ? 0 : std::min(data_size, data_size_));
   if (new_size != data_.size()) {
     data_.resize(new_size, std::byte{0});
   }
   data_size_ = data_size;
-  dirty_ = true;
 }
 
 void Block::Detach() {
   if (detached_)
     return;
-  device_->RemoveFromCache(physical_block_number_);
+  // Detached blocks are never flushed.
+  if (dirty_)
+    device_->RemoveDirtyBlock(this);
+  device_->RemoveFromCache(physical_block_number_, this);
   detached_ = true;
 }
 
 bool Block::Fetch(bool check_hash) {
   assert(!detached_);
+  if (auto res = FetchWithoutRead(check_hash))
+    return *res;
+  auto res = device_->ReadBlock(physical_block_number_, 1 << (log2_size() - ::log2_size(BlockSize::Physical)), data_,
+                                {hash(), DeviceEncryption::DIGEST_SIZE}, iv_, encrypted_, check_hash);
+  verified_ = check_hash && res;
+  return res;
+}
+
+// static
+bool Block::FetchBlocks(std::span<const std::shared_ptr<Block>> blocks, bool check_hash) {
+  return std::ranges::all_of(FetchBlocksResults(blocks, check_hash), [](bool res) { return res; });
+}
+
+// static
+std::vector<bool> Block::FetchBlocksResults(std::span<const std::shared_ptr<Block>> blocks, bool check_hash) {
+  std::vector<bool> results(blocks.size(), true);
+  std::vector<size_t> read_blocks;
+  std::vector<BlocksDevice::BlockRead> reads;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const auto& block = blocks[i];
+    assert(!block->detached_);
+    assert(block->device_ == blocks.front()->device_);
+    if (auto res = block->FetchWithoutRead(check_hash)) {
+      results[i] = *res;
+      continue;
+    }
+    read_blocks.push_back(i);
+    reads.push_back({block->physical_block_number_, block->data_, {block->hash(), DeviceEncryption::DIGEST_SIZE},
+                     block->iv_, block->encrypted_, check_hash});
+  }
+  if (!reads.empty()) {
+    auto read_results = blocks.front()->device_->ReadBlocks(reads);
+    for (size_t i = 0; i < read_results.size(); ++i) {
+      blocks[read_blocks[i]]->verified_ = check_hash && read_results[i];
+      results[read_blocks[i]] = read_results[i];
+    }
+  }
+  return results;
+}
+
+std::optional<bool> Block::FetchWithoutRead(bool check_hash) {
+  UnmapData();
   if (data_.size() == 0)
     return true;
-  return device_->ReadBlock(physical_block_number_, 1 << (log2_size() - ::log2_size(BlockSize::Physical)), data_,
-                            {hash(), DeviceEncryption::DIGEST_SIZE}, iv_, encrypted_, check_hash);
+  if (TakeRetainedData())
+    return true;
+  if (auto view = device_->GetBlockView(physical_block_number_, static_cast<uint32_t>(data_.size()), encrypted_);
+      !view.empty()) {
+    // No need for our own buffer as long as the block isn't modified.
+    mapped_data_ = view;
+    BlockBuffer().swap(data_);
+    return !check_hash || device_->CheckBlockHash(physical_block_number_, mapped_data_,
+                                                  {hash(), DeviceEncryption::DIGEST_SIZE}, iv_, encrypted_);
+  }
+  return std::nullopt;
+}
+
+bool Block::TakeRetainedData() {
+  auto retained = device_->TakeRetainedBlock(physical_block_number_);
+  if (!retained || retained->data.size() != data_.size() || retained->iv != iv_ || retained->encrypted != encrypted_)
+    return false;
+  // A data block is only reused if its hash in the metadata didn't change since it was verified.
+  if (hash_ref_.block &&
+      (!retained->external_hash || !std::ranges::equal(*retained->external_hash,
+                                                       std::span{hash(), DeviceEncryption::DIGEST_SIZE})))
+    return false;
+  data_ = std::move(retained->data);
+  verified_ = true;
+  reused_ = true;
+  return true;
+}
+
+void Block::RetainData() {
+  if (detached_ || dirty_ || !verified_ || data_.empty() || !mapped_data_.empty())
+    return;
+  RetainedBlocksCache::Entry entry{std::move(data_), 1u << (log2_size() - ::log2_size(BlockSize::Physical)), iv_,
+                                   encrypted_, std::nullopt};
+  if (hash_ref_.block) {
+    entry.external_hash.emplace();
+    std::copy_n(hash(), DeviceEncryption::DIGEST_SIZE, entry.external_hash->begin());
+  }
+  device_->RetainBlock(physical_block_number_, std::move(entry), reused_);
+}
+
+bool Block::QueueWriteback() {
+  if (detached_ || !dirty_ || !device_->writeback_enabled())
+    return false;
+  if (data_.size() > 0) {
+    DeviceEncryption::CalculateHash(data_, {mutable_hash(), DeviceEncryption::DIGEST_SIZE});
+    device_->QueueWrite(physical_block_number_, std::move(data_), iv_, encrypted_, dirty_offset_);
+  }
+  ClearDirty();
+  return true;
 }
 
 void Block::Flush() {
   if (detached_ || !dirty_)
     return;
   if (data_.size() > 0) {
-    device_->WriteBlock(physical_block_number_, 1 << (log2_size() - ::log2_size(BlockSize::Physical)), data_,
-                        {mutable_hash(), DeviceEncryption::DIGEST_SIZE}, iv_, encrypted_,
-                        /*recalculate_hash=*/true);
+    // Getting the hash location may dirty more of the block, if the hash is stored in it.
+    std::span<std::byte> hash{mutable_hash(), DeviceEncryption::DIGEST_SIZE};
+    device_->WriteBlock(physical_block_number_, 1 << (log2_size() - ::log2_size(BlockSize::Physical)), data_, hash, iv_,
+                        encrypted_, /*recalculate_hash=*/true, dirty_offset_);
+  }
+  ClearDirty();
+  verified_ = true;
+}
+
+// static
+void Block::FlushBlocks(std::span<const std::shared_ptr<Block>> blocks) {
+  std::vector<Block*> dirty_blocks;
+  std::vector<BlocksDevice::BlockWrite> writes;
+  auto add = [&](Block* block) {
+    dirty_blocks.push_back(block);
+    if (block->data_.size() > 0) {
+      // Getting the hash location may dirty more of the block, if the hash is stored in it.
+      std::span<std::byte> hash{block->mutable_hash(), DeviceEncryption::DIGEST_SIZE};
+      writes.push_back({block->physical_block_number_, block->data_, hash, block->iv_, block->encrypted_,
+                        /*recalculate_hash=*/true, block->dirty_offset_});
+    }
+  };
+  // Getting the hash location of a data block dirties the metadata block that stores it, so the data blocks are
+  // collected before the metadata blocks, including the metadata blocks that store their hashes.
+  std::vector<Block*> hash_blocks;
+  for (const auto& block : blocks) {
+    if (block->detached_ || !block->dirty_)
+      continue;
+    if (block->hash_ref_.block) {
+      add(block.get());
+      hash_blocks.push_back(block->hash_ref_.block.get());
+    } else {
+      hash_blocks.push_back(block.get());
+    }
+  }
+  std::ranges::sort(hash_blocks);
+  auto duplicates = std::ranges::unique(hash_blocks);
+  hash_blocks.erase(duplicates.begin(), duplicates.end());
+  for (auto* block : hash_blocks) {
+    if (!block->detached_ && block->dirty_ && !block->hash_ref_.block)
+      add(block);
+  }
+  if (!writes.empty())
+    blocks.front()->device_->WriteBlocks(writes);
+  for (auto* block : dirty_blocks) {
+    block->ClearDirty();
+    block->verified_ = true;
   }
-  dirty_ = false;
 }
 
 uint32_t Block::GetAlignedSize(uint32_t size) const {
@@ -99,12 +243,39 @@ uint32_t Block::GetAlignedSize(uint32_t size) const {
   return static_cast<uint32_t>(div_ceil(size, device_->device()->SectorSize()) * device_->device()->SectorSize());
 }
 
-std::span<std::byte> Block::GetDataForWriting() {
+std::span<std::byte> Block::GetDataForWriting(size_t dirty_offset) {
   assert(!device_ || !device_->device()->IsReadOnly());
-  dirty_ = true;
+  UnmapData();
+  SetDirty(dirty_offset);
   return {data_.data(), data_.data() + size()};
 }
 
+void Block::SetDirty(size_t dirty_offset) {
+  // Unless the device is known to have the rest of the block, all of it is written.
+  auto const offset = verified_ ? static_cast<uint32_t>(dirty_offset) : 0;
+  dirty_offset_ = dirty_ ? std::min(dirty_offset_, offset) : offset;
+  if (dirty_)
+    return;
+  dirty_ = true;
+  if (device_ && !detached_)
+    device_->AddDirtyBlock(this);
+}
+
+void Block::ClearDirty() {
+  if (!dirty_)
+    return;
+  dirty_ = false;
+  if (device_ && !detached_)
+    device_->RemoveDirtyBlock(this);
+}
+
+void Block::UnmapData() {
+  if (mapped_data_.empty())
+    return;
+  data_.assign(mapped_data_.begin(), mapped_data_.end());
+  mapped_data_ = {};
+}
+
 std::expected<std::shared_ptr<Block>, WfsError> Block::LoadDataBlock(std::shared_ptr<BlocksDevice> device,
                                                                      uint32_t physical_block_number,
                                                                      BlockSize block_size,
@@ -115,25 +286,60 @@ std::expected<std::shared_ptr<Block>, WfsError> Block::LoadDataBlock(std::shared
                                                                      bool encrypted,
                                                                      bool load_data,
                                                                      bool check_hash) {
-  auto cached_block = device->GetFromCache(physical_block_number);
-  if (cached_block) {
-    assert(cached_block->physical_block_number() == physical_block_number);
-    assert(cached_block->block_size() == block_size);
-    assert(cached_block->block_type() == block_type);
-    assert(cached_block->size() == data_size);
-    assert(cached_block->encrypted() == encrypted);
-    return cached_block;
-  }
-  auto block = std::make_shared<Block>(device, physical_block_number, block_size, block_type, data_size, iv,
-                                       std::move(data_hash), encrypted);
-  device->AddToCache(physical_block_number, block);
-  if (load_data) {
-    if (!block->Fetch(check_hash))
+  auto cached = device->GetOrAddToCache(physical_block_number, [&] {
+    return std::make_shared<Block>(device, physical_block_number, block_size, block_type, data_size, iv,
+                                   std::move(data_hash), encrypted, /*zero_fill=*/!load_data);
+  });
+  auto& block = cached.block;
+  if (!cached.added) {
+    assert(block->physical_block_number() == physical_block_number);
+    assert(block->block_size() == block_size);
+    assert(block->block_type() == block_type);
+    assert(block->size() == data_size);
+    assert(block->encrypted() == encrypted);
+    if (cached.bad_hash)
       return std::unexpected(WfsError::kBlockBadHash);
+    return block;
+  }
+  bool loaded = true;
+  if (load_data) {
+    try {
+      loaded = block->Fetch(check_hash);
+    } catch (...) {
+      // Not a bad hash, the threads that wait for the block load it again and get the error themselves.
+      block->Detach();
+      throw;
+    }
   }
+  device->SetLoaded(physical_block_number, block.get(), loaded);
+  if (!loaded)
+    return std::unexpected(WfsError::kBlockBadHash);
   return block;
 }
 
+// static
+std::expected<bool, WfsError> Block::ReadDataBlockRange(const std::shared_ptr<BlocksDevice>& device,
+                                                        uint32_t physical_block_number,
+                                                        uint32_t data_size,
+                                                        uint32_t iv,
+                                                        bool encrypted,
+                                                        size_t offset,
+                                                        std::span<std::byte> output) {
+  assert(offset + output.size() <= data_size);
+  // The cached block may be modified, and the device doesn't have its changes yet.
+  auto cached = device->GetOrAddToCache(physical_block_number, nullptr);
+  if (cached.bad_hash)
+    return std::unexpected(WfsError::kBlockBadHash);
+  if (cached.block) {
+    std::ranges::copy(cached.block->data().subspan(offset, output.size()), output.begin());
+    return true;
+  }
+  auto const sector_size = device->device()->SectorSize();
+  device->ReadBlockRange(physical_block_number, static_cast<uint32_t>(div_ceil(data_size, sector_size) * sector_size),
+                         static_cast<uint32_t>(offset), output, iv, encrypted);
+  return false;
+}
+
 std::expected<std::shared_ptr<Block>, WfsError> Block::LoadMetadataBlock(std::shared_ptr<BlocksDevice> device,
                                                                          uint32_t block_number,
                                                                          BlockSize block_size,
@@ -144,6 +350,65 @@ std::expected<std::shared_ptr<Block>, WfsError> Block::LoadMetadataBlock(std::sh
                        {nullptr, offsetof(MetadataBlockHeader, hash)}, /*encrypted=*/true, load_data, check_hash);
 }
 
+// static
+std::expected<std::vector<std::shared_ptr<Block>>, WfsError> Block::LoadMetadataBlocks(
+    std::shared_ptr<BlocksDevice> device,
+    std::span<const uint32_t> physical_block_numbers,
+    BlockSize block_size,
+    std::span<const uint32_t> ivs) {
+  assert(physical_block_numbers.size() == ivs.size());
+  std::vector<std::shared_ptr<Block>> blocks(physical_block_numbers.size());
+  std::vector<std::shared_ptr<Block>> blocks_to_fetch;
+  bool bad_hash = false;
+  // Don't wait for the blocks that other threads are loading before the blocks we added are loaded, since they may be
+  // waiting for ours.
+  for (size_t i = 0; i < physical_block_numbers.size(); ++i) {
+    auto cached = device->GetOrAddToCache(
+        physical_block_numbers[i],
+        [&] {
+          return std::make_shared<Block>(device, physical_block_numbers[i], block_size, BlockType::Single,
+                                         1 << ::log2_size(block_size), ivs[i],
+                                         HashRef{nullptr, offsetof(MetadataBlockHeader, hash)}, /*encrypted=*/true,
+                                         /*zero_fill=*/false);
+        },
+        /*wait=*/false);
+    if (cached.added)
+      blocks_to_fetch.push_back(cached.block);
+    bad_hash = bad_hash || cached.bad_hash;
+    blocks[i] = std::move(cached.block);
+  }
+  std::vector<bool> results;
+  try {
+    results = FetchBlocksResults(blocks_to_fetch, /*check_hash=*/true);
+  } catch (...) {
+    // Not a bad hash, the threads that wait for the blocks load them again and get the error themselves.
+    for (const auto& block : blocks_to_fetch)
+      block->Detach();
+    throw;
+  }
+  for (size_t i = 0; i < blocks_to_fetch.size(); ++i) {
+    device->SetLoaded(blocks_to_fetch[i]->physical_block_number_, blocks_to_fetch[i].get(), results[i]);
+    bad_hash = bad_hash || !results[i];
+  }
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    if (!blocks[i]) {
+      auto cached = device->GetOrAddToCache(physical_block_numbers[i], nullptr);
+      if (!cached.block) {
+        // Released by the thread that loaded it, load it ourselves.
+        auto block = LoadMetadataBlock(device, physical_block_numbers[i], block_size, ivs[i]);
+        if (!block)
+          return std::unexpected(block.error());
+        cached.block = std::move(*block);
+      }
+      bad_hash = bad_hash || cached.bad_hash;
+      blocks[i] = std::move(cached.block);
+    }
+  }
+  if (bad_hash)
+    return std::unexpected(WfsError::kBlockBadHash);
+  return blocks;
+}
+
 std::shared_ptr<Block> Block::CreateDetached(std::vector<std::byte> data) {
   return std::make_shared<Block>(std::move(data));
 }
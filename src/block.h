@@ -8,10 +8,14 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
+#include <iterator>
 #include <memory>
+#include <optional>
 #include <span>
 #include <vector>
 
+#include "block_buffer_pool.h"
 #include "errors.h"
 
 class BlocksDevice;
@@ -45,7 +49,28 @@ constexpr inline auto log2_size(BlockType size) {
   return static_cast<int>(size);
 }
 
-class Block {
+// The largest block (a cluster) in physical blocks.
+constexpr uint32_t kMaxPhysicalBlocksCount =
+    uint32_t{1} << (log2_size(BlockSize::Logical) + log2_size(BlockType::Cluster) - log2_size(BlockSize::Physical));
+
+// Calls erase(it) for each entry of a map keyed by physical block number that overlaps the physical blocks
+// [block_number, block_number + blocks_count). blocks_count_of(entry) returns the size of an entry in physical blocks.
+template <typename Map, typename BlocksCountOf, typename Erase>
+void EraseOverlappingBlocks(Map& map,
+                            uint32_t block_number,
+                            uint32_t blocks_count,
+                            BlocksCountOf blocks_count_of,
+                            Erase erase) {
+  auto it = map.lower_bound(block_number >= kMaxPhysicalBlocksCount ? block_number - kMaxPhysicalBlocksCount + 1 : 0);
+  while (it != map.end() && it->first < block_number + blocks_count) {
+    auto next = std::next(it);
+    if (it->first + blocks_count_of(it->second) > block_number)
+      erase(it);
+    it = next;
+  }
+}
+
+class Block : public std::enable_shared_from_this<Block> {
  public:
   template <typename T, BlockRef BlockRefType>
   struct DataRefBase {
@@ -84,11 +109,17 @@ class Block {
         uint32_t data_size,
         uint32_t iv,
         HashRef hash_ref,
-        bool encrypted);
+        bool encrypted,
+        bool zero_fill = true);
   Block(std::vector<std::byte> data);
   virtual ~Block();
 
   bool Fetch(bool check_hash = true);
+  // Fetches several blocks of the same device together, see BlocksDevice::ReadBlocks. Returns false if any of them
+  // failed the hash check.
+  static bool FetchBlocks(std::span<const std::shared_ptr<Block>> blocks, bool check_hash = true);
+  // Flushes the dirty blocks of the same device together, see BlocksDevice::WriteBlocks.
+  static void FlushBlocks(std::span<const std::shared_ptr<Block>> blocks);
   void Flush();
 
   // Actual used size, always equal to capacity in metadata blocks.
@@ -97,9 +128,17 @@ class Block {
   // Allocated size for the block
   uint32_t capacity() const { return 1 << log2_size(); }
 
-  std::span<const std::byte> data() const { return {data_.data(), data_.data() + size()}; }
+  std::span<const std::byte> data() const {
+    auto* begin = mapped_data_.empty() ? data_.data() : mapped_data_.data();
+    return {begin, begin + size()};
+  }
   // Accessing the non-const variant of data will mark the block as dirty.
-  std::span<std::byte> mutable_data() { return GetDataForWriting(); }
+  std::span<std::byte> mutable_data() { return GetDataForWriting(0); }
+  // Same, for modifying only |size| bytes from |offset|. Only the sectors from the first modified one are written.
+  std::span<std::byte> mutable_data(size_t offset, size_t size) {
+    assert(offset + size <= this->size());
+    return GetDataForWriting(offset).subspan(offset, size);
+  }
 
   template <typename T>
   const T* get_object(size_t offset) const {
@@ -109,13 +148,12 @@ class Block {
 
   template <typename T>
   T* get_mutable_object(size_t offset) {
-    assert(offset + sizeof(T) <= size());
-    return reinterpret_cast<T*>(mutable_data().data() + offset);
+    return reinterpret_cast<T*>(mutable_data(offset, sizeof(T)).data());
   }
 
   template <typename T>
   size_t to_offset(const T* obj) const {
-    auto res = reinterpret_cast<const std::byte*>(obj) - data_.data();
+    auto res = reinterpret_cast<const std::byte*>(obj) - data().data();
     assert(res >= 0 && res < static_cast<std::ptrdiff_t>(size()));
     // TODO: [[assume(res >= 0)]]; and remove cast
     return static_cast<size_t>(res);
@@ -144,6 +182,17 @@ class Block {
                                                                        bool load_data = true,
                                                                        bool check_hash = true);
 
+  // Copies |output.size()| bytes from |offset| of a data block without loading it. The cached block is used if there is
+  // one, otherwise only the sectors of the range are read (see BlocksDevice::ReadBlockRange). Returns false in this
+  // case, the hash of the block wasn't checked. Fails if the cached block is known to be corrupted.
+  static std::expected<bool, WfsError> ReadDataBlockRange(const std::shared_ptr<BlocksDevice>& device,
+                                                          uint32_t physical_block_number,
+                                                          uint32_t data_size,
+                                                          uint32_t iv,
+                                                          bool encrypted,
+                                                          size_t offset,
+                                                          std::span<std::byte> output);
+
   static std::expected<std::shared_ptr<Block>, WfsError> LoadMetadataBlock(std::shared_ptr<BlocksDevice> device,
                                                                            uint32_t physical_block_number,
                                                                            BlockSize block_size,
@@ -151,12 +200,35 @@ class Block {
                                                                            bool load_data = true,
                                                                            bool check_hash = true);
 
+  // Loads several metadata blocks of the same device, the blocks that aren't cached are fetched together.
+  static std::expected<std::vector<std::shared_ptr<Block>>, WfsError> LoadMetadataBlocks(
+      std::shared_ptr<BlocksDevice> device,
+      std::span<const uint32_t> physical_block_numbers,
+      BlockSize block_size,
+      std::span<const uint32_t> ivs);
+
   static std::shared_ptr<Block> CreateDetached(std::vector<std::byte> data);
 
  private:
   uint32_t GetAlignedSize(uint32_t size) const;
 
-  std::span<std::byte> GetDataForWriting();
+  // Same as FetchBlocks, with the hash check result of each block.
+  static std::vector<bool> FetchBlocksResults(std::span<const std::shared_ptr<Block>> blocks, bool check_hash);
+  // Fetches the block when it doesn't need to be read from the device. Returns the hash check result in this case.
+  std::optional<bool> FetchWithoutRead(bool check_hash);
+  // Hands the block to the writeback thread of the device, if it is enabled, when the block is released dirty.
+  bool QueueWriteback();
+  // Takes the data from the retained blocks cache of the device, if it was retained with the same parameters.
+  bool TakeRetainedData();
+  // Hands the data to the retained blocks cache of the device when the block is released.
+  void RetainData();
+
+  std::span<std::byte> GetDataForWriting(size_t dirty_offset);
+  // Keep the dirty blocks list of the device up to date.
+  void SetDirty(size_t dirty_offset);
+  void ClearDirty();
+  // Copy the mapped device data to our own buffer before it is modified.
+  void UnmapData();
 
   std::byte* mutable_hash() {
     return (hash_ref_.block ? hash_ref_.block.get() : this)->get_mutable_object<std::byte>(hash_ref_.offset);
@@ -175,9 +247,22 @@ class Block {
   bool encrypted_;
 
   bool dirty_{false};
+  // Offset of the first byte that was modified since the block was last in sync with the device, while dirty.
+  uint32_t dirty_offset_{0};
+  // Links in the dirty blocks list of the device.
+  Block* prev_dirty_{nullptr};
+  Block* next_dirty_{nullptr};
   bool detached_{false};
+  // Whether data_ is known to match the device, either because it was verified when read or because it was written.
+  bool verified_{false};
+  // Whether the data was taken from the retained blocks cache.
+  bool reused_{false};
 
   HashRef hash_ref_;
-  // data buffer of at least size_, rounded to sector.
-  std::vector<std::byte> data_;
+  // data buffer of at least size_, rounded to sector. Aligned so it can be used for direct I/O.
+  BlockBuffer data_;
+  // View of the block in the device memory, used instead of data_ until the block is modified.
+  std::span<const std::byte> mapped_data_;
+
+  friend class BlocksDevice;
 };
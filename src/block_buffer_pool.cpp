@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "block_buffer_pool.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// static
+BlockBufferPool& BlockBufferPool::Get() {
+  // Never destroyed, so blocks that outlive static destruction can still free their buffers.
+  static auto* pool = new BlockBufferPool();
+  return *pool;
+}
+
+std::byte* BlockBufferPool::Allocate(size_t size) {
+  auto const index = SizeClassIndex(size);
+  if (index >= size_classes_.size())
+    return static_cast<std::byte*>(::operator new(size, std::align_val_t{kDirectIoAlignment}));
+  auto& size_class = size_classes_[index];
+  std::lock_guard<std::mutex> guard(size_class.lock);
+  if (size_class.available_slabs.empty()) {
+    auto const buffer_size = size_t{1} << (index + kMinLog2Size);
+    auto* slab_data = AllocateSlab();
+    auto& slab = size_class.slabs[slab_data];
+    slab.free_buffers.reserve(kSlabSize / buffer_size);
+    for (size_t offset = kSlabSize; offset > 0; offset -= buffer_size)
+      slab.free_buffers.push_back(slab_data + offset - buffer_size);
+    size_class.available_slabs.push_back(slab_data);
+  }
+  auto* slab_data = size_class.available_slabs.back();
+  auto& slab = size_class.slabs.at(slab_data);
+  if (size_class.empty_slab == slab_data)
+    size_class.empty_slab = nullptr;
+  auto* buffer = slab.free_buffers.back();
+  slab.free_buffers.pop_back();
+  if (slab.free_buffers.empty())
+    size_class.available_slabs.pop_back();
+  return buffer;
+}
+
+void BlockBufferPool::Free(std::byte* data, size_t size) {
+  auto const index = SizeClassIndex(size);
+  if (index >= size_classes_.size()) {
+    ::operator delete(data, std::align_val_t{kDirectIoAlignment});
+    return;
+  }
+  auto& size_class = size_classes_[index];
+  // Slabs are aligned to their size.
+  auto* slab_data = data - reinterpret_cast<uintptr_t>(data) % kSlabSize;
+  std::lock_guard<std::mutex> guard(size_class.lock);
+  auto& slab = size_class.slabs.at(slab_data);
+  slab.free_buffers.push_back(data);
+  if (slab.free_buffers.size() == 1)
+    size_class.available_slabs.push_back(slab_data);
+  if (slab.free_buffers.size() < kSlabSize >> (index + kMinLog2Size))
+    return;
+  if (!size_class.empty_slab) {
+    size_class.empty_slab = slab_data;
+    return;
+  }
+  std::erase(size_class.available_slabs, slab_data);
+  size_class.slabs.erase(slab_data);
+  FreeSlab(slab_data);
+}
+
+size_t BlockBufferPool::SlabsSize() {
+  size_t size = 0;
+  for (auto& size_class : size_classes_) {
+    std::lock_guard<std::mutex> guard(size_class.lock);
+    size += size_class.slabs.size() * kSlabSize;
+  }
+  return size;
+}
+
+// static
+size_t BlockBufferPool::SizeClassIndex(size_t size) {
+  if (size <= (size_t{1} << kMinLog2Size))
+    return 0;
+  return static_cast<size_t>(std::bit_width(size - 1)) - kMinLog2Size;
+}
+
+// static
+std::byte* BlockBufferPool::AllocateSlab() {
+  // Slabs are aligned to their size, so they can be backed by huge pages.
+#ifdef __linux__
+  // Mapped directly, so freeing a slab always gives its memory back, the heap may keep it.
+  auto* mapping = static_cast<std::byte*>(
+      mmap(nullptr, 2 * kSlabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (mapping == MAP_FAILED)
+    throw std::bad_alloc();
+  auto const head = (kSlabSize - reinterpret_cast<uintptr_t>(mapping) % kSlabSize) % kSlabSize;
+  auto* slab = mapping + head;
+  if (head > 0)
+    munmap(mapping, head);
+  munmap(slab + kSlabSize, kSlabSize - head);
+#ifdef MADV_HUGEPAGE
+  madvise(slab, kSlabSize, MADV_HUGEPAGE);
+#endif
+  return slab;
+#else
+  return static_cast<std::byte*>(::operator new(kSlabSize, std::align_val_t{kSlabSize}));
+#endif
+}
+
+// static
+void BlockBufferPool::FreeSlab(std::byte* slab) {
+#ifdef __linux__
+  munmap(slab, kSlabSize);
+#else
+  ::operator delete(slab, std::align_val_t{kSlabSize});
+#endif
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "aligned_allocator.h"
+
+// Pool of block buffers in power of two size classes, from a physical block (4KB) to a logical cluster (512KB). Each
+// size class carves its buffers from its own 2MB slabs (huge page backed where the host allows it), and freed buffers
+// are kept for reuse. A slab is returned to the system once all its buffers are free, except for one per size class, so
+// a burst of allocations doesn't pin its peak memory. Buffers are aligned to kDirectIoAlignment. Larger sizes are
+// allocated from the heap directly.
+class BlockBufferPool {
+ public:
+  static constexpr size_t kSlabSize = 2 << 20;
+
+  static BlockBufferPool& Get();
+
+  std::byte* Allocate(size_t size);
+  void Free(std::byte* data, size_t size);
+
+  // Size of the slabs of all the size classes.
+  size_t SlabsSize();
+
+ private:
+  static constexpr size_t kMinLog2Size = 12;
+  static constexpr size_t kMaxLog2Size = 19;
+
+  struct Slab {
+    std::vector<std::byte*> free_buffers;
+  };
+
+  struct SizeClass {
+    std::mutex lock;
+    std::unordered_map<std::byte*, Slab> slabs;
+    // Slabs that have free buffers, buffers are taken from the last one.
+    std::vector<std::byte*> available_slabs;
+    // The slab whose buffers are all free that is kept, if there is one.
+    std::byte* empty_slab{nullptr};
+  };
+
+  BlockBufferPool() = default;
+
+  static size_t SizeClassIndex(size_t size);
+  static std::byte* AllocateSlab();
+  static void FreeSlab(std::byte* slab);
+
+  std::array<SizeClass, kMaxLog2Size - kMinLog2Size + 1> size_classes_;
+};
+
+// Allocator for vectors of block data, draws from the BlockBufferPool. Resizing with no value doesn't zero-fill the new
+// elements, for buffers that are about to be overwritten.
+template <typename T>
+class BlockBufferAllocator {
+ public:
+  using value_type = T;
+
+  BlockBufferAllocator() = default;
+  template <typename U>
+  BlockBufferAllocator(const BlockBufferAllocator<U>&) {}
+
+  T* allocate(size_t n) { return reinterpret_cast<T*>(BlockBufferPool::Get().Allocate(n * sizeof(T))); }
+  void deallocate(T* p, size_t n) { BlockBufferPool::Get().Free(reinterpret_cast<std::byte*>(p), n * sizeof(T)); }
+
+  template <typename U>
+  void construct(U* p) noexcept(std::is_nothrow_default_constructible_v<U>) {
+    ::new (static_cast<void*>(p)) U;
+  }
+  template <typename U, typename... Args>
+  void construct(U* p, Args&&... args) {
+    std::construct_at(p, std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  bool operator==(const BlockBufferAllocator<U>&) const {
+    return true;
+  }
+};
+
+using BlockBuffer = std::vector<std::byte, BlockBufferAllocator<std::byte>>;
@@ -5,38 +5,52 @@
  * of the MIT license.  See the LICENSE file for details.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <stdexcept>
 
+#include "aligned_allocator.h"
 #include "block.h"
 #include "blocks_device.h"
 #include "device.h"
 #include "device_encryption.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+namespace {
+VerifiedBlocks::Entry VerifiedEntry(std::span<const std::byte> data,
+                                    std::span<const std::byte> hash,
+                                    uint32_t iv,
+                                    bool encrypt) {
+  VerifiedBlocks::Entry entry{static_cast<uint32_t>(data.size()), iv, encrypt, {}};
+  std::ranges::copy(hash.first(DeviceEncryption::DIGEST_SIZE), entry.hash.begin());
+  return entry;
+}
+}  // namespace
 
 BlocksDevice::BlocksDevice(std::shared_ptr<Device> device, std::optional<std::vector<std::byte>> key)
     : device_(std::move(device)),
       device_encryption_(key ? std::make_unique<DeviceEncryption>(device_, std::move(*key)) : nullptr) {}
 
+BlocksDevice::~BlocksDevice() {
+  StopWriteback();
+  SetReadAheadWindow(0);
+}
+
 void BlocksDevice::WriteBlock(uint32_t block_number,
                               uint32_t /*size_in_blocks*/,
                               const std::span<std::byte>& data,
                               const std::span<std::byte>& hash,
                               uint32_t iv,
                               bool encrypt,
-                              bool recalculate_hash) {
-  assert(data.size() % device_->SectorSize() == 0);
-  auto const sector_address = ToDeviceSector(block_number);
-  auto const sectors_count = static_cast<uint32_t>(data.size() / device_->SectorSize());
-
-  if (recalculate_hash)
-    DeviceEncryption::CalculateHash(data, hash);
-
-  if (encrypt && device_encryption_) {
-    std::vector<std::byte> enc_data(data.begin(), data.end());
-    device_encryption_->EncryptBlock(enc_data, iv);
-    device_->WriteSectors(enc_data, sector_address, sectors_count);
-  } else {
-    device_->WriteSectors(data, sector_address, sectors_count);
-  }
+                              bool recalculate_hash,
+                              uint32_t dirty_offset) {
+  BlockWrite block{block_number, data, hash, iv, encrypt, recalculate_hash, dirty_offset};
+  std::lock_guard<std::mutex> writeback_guard(writeback_io_lock_);
+  if (CancelPendingWrites(block_number,
+                          static_cast<uint32_t>(div_ceil_pow2(data.size(), log2_size(BlockSize::Physical)))))
+    block.dirty_offset = 0;
+  WriteBlocksToDevice({&block, 1});
 }
 
 bool BlocksDevice::ReadBlock(uint32_t block_number,
@@ -49,11 +63,483 @@ bool BlocksDevice::ReadBlock(uint32_t block_number,
   assert(data.size() % device_->SectorSize() == 0);
   auto const sector_address = ToDeviceSector(block_number);
   auto const sectors_count = static_cast<uint32_t>(data.size() / device_->SectorSize());
-  device_->ReadSectors(data, sector_address, sectors_count);
+  if (ReadPendingWrite(block_number, data))
+    return !check_hash || DeviceEncryption::CheckHash(data, hash);
+  bool read;
+  {
+    std::vector<ReadAheadWindow> dropped;
+    std::lock_guard<std::mutex> guard(state_lock_);
+    UpdateReadAhead(block_number, static_cast<uint32_t>(div_ceil_pow2(data.size(), log2_size(BlockSize::Physical))),
+                    dropped);
+    read = TakePrefetchedBlock(block_number, data);
+  }
+  if (!read)
+    read = TakeReadAhead(block_number, data);
+  if (!read)
+    device_->ReadSectors(data, sector_address, sectors_count);
 
-  if (encrypt && device_encryption_)
+  if (encrypt && device_encryption_) {
+    // The hash of a block that was verified before can only be compared after the decryption.
+    if (check_hash && !MaybeVerified(block_number, data.size(), iv, encrypt)) {
+      if (!device_encryption_->DecryptBlockAndCheckHash(data, iv, hash))
+        return false;
+      SetVerified(block_number, data, hash, iv, encrypt);
+      return true;
+    }
     device_encryption_->DecryptBlock(data, iv);
-  return !check_hash || DeviceEncryption::CheckHash(data, hash);
+  }
+  return !check_hash || CheckBlockHash(block_number, data, hash, iv, encrypt);
+}
+
+void BlocksDevice::ReadBlockRange(uint32_t block_number,
+                                  uint32_t block_size,
+                                  uint32_t offset,
+                                  const std::span<std::byte>& data,
+                                  uint32_t iv,
+                                  bool encrypt) {
+  assert(block_size % device_->SectorSize() == 0 && offset + data.size() <= block_size);
+  if (data.empty() || ReadPendingWrite(block_number, block_size, offset, data))
+    return;
+  auto const log2_sector_size = device_->Log2SectorSize();
+  auto const first_sector = offset >> log2_sector_size;
+  auto const end_sector = static_cast<uint32_t>(div_ceil_pow2(offset + data.size(), log2_sector_size));
+  bool const decrypt = encrypt && device_encryption_;
+  // CBC decryption of a sector only needs the last cipher block of the sector before it.
+  bool const chained = decrypt && first_sector > 0;
+  auto const read_sector = first_sector - (chained ? 1 : 0);
+  AlignedBuffer sectors(size_t{end_sector - read_sector} << log2_sector_size);
+  device_->ReadSectors(sectors, ToDeviceSector(block_number) + read_sector, end_sector - read_sector);
+  auto range = std::span{sectors}.subspan(chained ? device_->SectorSize() : 0);
+  if (decrypt)
+    device_encryption_->DecryptBlockRange(range, block_size, iv,
+                                          chained ? range.data() - DeviceEncryption::kCipherBlockSize : nullptr);
+  std::copy_n(range.begin() + (offset - (first_sector << log2_sector_size)), data.size(), data.begin());
+}
+
+std::span<const std::byte> BlocksDevice::GetBlockView(uint32_t block_number, uint32_t size, bool encrypt) const {
+  if (encrypt && device_encryption_)
+    return {};
+  assert(size % device_->SectorSize() == 0);
+  {
+    std::lock_guard<std::mutex> guard(writeback_lock_);
+    if (pending_writes_.contains(block_number))
+      return {};
+  }
+  return device_->SectorsView(ToDeviceSector(block_number), size / device_->SectorSize());
+}
+
+void BlocksDevice::WriteBlocks(std::span<const BlockWrite> blocks) {
+  std::lock_guard<std::mutex> writeback_guard(writeback_io_lock_);
+  // A block that replaces a pending write is written whole, the device doesn't have its start yet.
+  std::vector<BlockWrite> whole_blocks;
+  for (const auto& block : blocks) {
+    if (CancelPendingWrites(block.block_number,
+                            static_cast<uint32_t>(div_ceil_pow2(block.data.size(), log2_size(BlockSize::Physical)))) &&
+        block.dirty_offset > 0) {
+      if (whole_blocks.empty())
+        whole_blocks.assign(blocks.begin(), blocks.end());
+      whole_blocks[static_cast<size_t>(&block - blocks.data())].dirty_offset = 0;
+    }
+  }
+  WriteBlocksToDevice(whole_blocks.empty() ? blocks : whole_blocks);
+}
+
+void BlocksDevice::WriteBlocksToDevice(std::span<const BlockWrite> blocks) {
+  // Staging buffers are written in batches of up to this size.
+  constexpr size_t kMaxStagingSize = 8 << 20;
+
+  auto hash_in_block = [](const BlockWrite& block) {
+    return block.hash.data() >= block.data.data() && block.hash.data() < block.data.data() + block.data.size();
+  };
+  // Hashes that are stored in other blocks first, they are part of the data of those blocks.
+  for (bool in_block : {false, true}) {
+    std::vector<std::span<const std::byte>> data;
+    std::vector<std::span<std::byte>> hashes;
+    for (const auto& block : blocks) {
+      if (block.recalculate_hash && hash_in_block(block) == in_block) {
+        data.push_back(block.data);
+        hashes.push_back(block.hash);
+      }
+    }
+    DeviceEncryption::CalculateHashes(data, hashes);
+  }
+
+  // The part of each block that is written, from the sector of its dirty offset.
+  struct BlockTail {
+    const BlockWrite* block;
+    uint32_t sector_address;
+    std::span<const std::byte> data;
+    // The cipher block that the encryption of a partial block is chained to.
+    std::array<std::byte, DeviceEncryption::kCipherBlockSize> previous_cipher_block;
+  };
+  std::vector<BlockTail> tails;
+  tails.reserve(blocks.size());
+  std::vector<AlignedBuffer> previous_sectors;
+  std::vector<Device::SectorsRange> previous_sectors_ranges;
+  for (const auto& block : blocks) {
+    assert(block.data.size() % device_->SectorSize() == 0);
+    if (block.data.empty())
+      continue;
+    auto const first_sector = std::min<size_t>(block.dirty_offset, block.data.size() - 1) >> device_->Log2SectorSize();
+    auto const sector_address = ToDeviceSector(block.block_number) + static_cast<uint32_t>(first_sector);
+    tails.push_back({&block, sector_address, block.data.subspan(first_sector << device_->Log2SectorSize()), {}});
+    if (first_sector > 0 && block.encrypt && device_encryption_) {
+      previous_sectors.emplace_back(device_->SectorSize());
+      previous_sectors_ranges.push_back({previous_sectors.back(), sector_address - 1});
+    }
+  }
+  if (!previous_sectors_ranges.empty()) {
+    device_->ReadSectorsBatch(previous_sectors_ranges);
+    auto previous_sector = previous_sectors.begin();
+    for (auto& tail : tails) {
+      if (tail.data.size() < tail.block->data.size() && tail.block->encrypt && device_encryption_) {
+        std::copy(previous_sector->end() - DeviceEncryption::kCipherBlockSize, previous_sector->end(),
+                  tail.previous_cipher_block.begin());
+        ++previous_sector;
+      }
+    }
+  }
+  std::ranges::sort(tails, {}, &BlockTail::sector_address);
+
+  std::vector<AlignedBuffer> staging_buffers;
+  std::vector<Device::SectorsRange> ranges;
+  std::vector<DeviceEncryption::BlockRef> to_encrypt;
+  size_t staging_size = 0;
+  auto write_batch = [&]() {
+    // The blocks of the batch are encrypted together, interleaved.
+    if (!to_encrypt.empty())
+      device_encryption_->EncryptBlocks(to_encrypt);
+    if (!ranges.empty())
+      device_->WriteSectorsBatch(ranges);
+    ranges.clear();
+    to_encrypt.clear();
+    staging_buffers.clear();
+    staging_size = 0;
+  };
+  for (size_t first = 0; first < tails.size();) {
+    auto const sector_address = tails[first].sector_address;
+    auto run_end = sector_address + tails[first].data.size() / device_->SectorSize();
+    auto last = first + 1;
+    while (last < tails.size() && tails[last].sector_address == run_end) {
+      run_end += tails[last].data.size() / device_->SectorSize();
+      ++last;
+    }
+    auto& staging = staging_buffers.emplace_back();
+    staging.reserve((run_end - sector_address) * device_->SectorSize());
+    for (size_t i = first; i < last; ++i) {
+      const auto& tail = tails[i];
+      auto offset = staging.size();
+      staging.insert(staging.end(), tail.data.begin(), tail.data.end());
+      if (tail.block->encrypt && device_encryption_) {
+        bool const partial = tail.data.size() < tail.block->data.size();
+        to_encrypt.push_back({{staging.data() + offset, tail.data.size()},
+                              tail.block->iv,
+                              partial ? tail.previous_cipher_block.data() : nullptr});
+      }
+    }
+    ranges.push_back({staging, sector_address});
+    staging_size += staging.size();
+    if (staging_size >= kMaxStagingSize)
+      write_batch();
+    first = last;
+  }
+  write_batch();
+
+  // Dropped after the write, so nothing that was read while it was in flight is kept.
+  std::vector<ReadAheadWindow> dropped;
+  std::lock_guard<std::mutex> guard(state_lock_);
+  for (const auto& block : blocks) {
+    auto const blocks_count = static_cast<uint32_t>(div_ceil_pow2(block.data.size(), log2_size(BlockSize::Physical)));
+    if (auto prefetched = prefetched_blocks_.find(block.block_number); prefetched != prefetched_blocks_.end())
+      ErasePrefetchedBlock(prefetched);
+    retained_blocks_.Invalidate(block.block_number, blocks_count);
+    verified_blocks_.Invalidate(block.block_number, blocks_count);
+    DropReadAhead(block.block_number, blocks_count, dropped);
+  }
+}
+
+std::vector<bool> BlocksDevice::ReadBlocks(std::span<const BlockRead> blocks) {
+  // Blocks that are waiting for the writeback are copied as is, without decryption.
+  std::vector<bool> pending;
+  pending.reserve(blocks.size());
+  for (const auto& block : blocks)
+    pending.push_back(ReadPendingWrite(block.block_number, block.data));
+
+  std::vector<RawBlock> raw_blocks;
+  raw_blocks.reserve(blocks.size());
+  {
+    std::lock_guard<std::mutex> guard(state_lock_);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      const auto& block = blocks[i];
+      assert(block.data.size() % device_->SectorSize() == 0);
+      if (!pending[i] && !TakePrefetchedBlock(block.block_number, block.data))
+        raw_blocks.push_back({block.block_number, block.data});
+    }
+  }
+  ReadRawBlocks(std::move(raw_blocks));
+
+  // Large blocks are decrypted and checked in a single pass, the rest are decrypted and then hashed together. Blocks
+  // that were already verified against the same hash aren't hashed again.
+  std::vector<bool> results(blocks.size(), true);
+  std::vector<size_t> hashed_blocks;
+  std::vector<std::span<const std::byte>> data;
+  std::vector<std::span<const std::byte>> hashes;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const auto& block = blocks[i];
+    bool const decrypt = !pending[i] && block.encrypt && device_encryption_;
+    bool const maybe_verified =
+        !pending[i] && MaybeVerified(block.block_number, block.data.size(), block.iv, block.encrypt);
+    if (decrypt && block.check_hash && !maybe_verified && block.data.size() >= kMinFusedDecryptSize) {
+      results[i] = device_encryption_->DecryptBlockAndCheckHash(block.data, block.iv, block.hash);
+      if (results[i])
+        SetVerified(block.block_number, block.data, block.hash, block.iv, block.encrypt);
+      continue;
+    }
+    if (decrypt)
+      device_encryption_->DecryptBlock(block.data, block.iv);
+    if (block.check_hash) {
+      if (maybe_verified && IsVerified(block.block_number, block.data, block.hash, block.iv, block.encrypt))
+        continue;
+      hashed_blocks.push_back(i);
+      data.push_back(block.data);
+      hashes.push_back(block.hash);
+    }
+  }
+  auto hashes_results = DeviceEncryption::CheckHashes(data, hashes);
+  for (size_t i = 0; i < hashed_blocks.size(); ++i) {
+    const auto& block = blocks[hashed_blocks[i]];
+    results[hashed_blocks[i]] = hashes_results[i];
+    if (hashes_results[i] && !pending[hashed_blocks[i]])
+      SetVerified(block.block_number, block.data, block.hash, block.iv, block.encrypt);
+  }
+  return results;
+}
+
+void BlocksDevice::PrefetchBlocks(std::span<const BlockExtent> blocks) {
+  auto is_loaded = [this](uint32_t block_number) {
+    {
+      auto& shard = GetCacheShard(block_number);
+      std::lock_guard<std::mutex> guard(shard.lock);
+      if (shard.blocks.contains(block_number))
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(state_lock_);
+    return prefetched_blocks_.contains(block_number);
+  };
+  std::vector<AlignedBuffer> buffers;
+  std::vector<uint32_t> block_numbers;
+  std::vector<RawBlock> raw_blocks;
+  buffers.reserve(blocks.size());
+  size_t prefetch_size = 0;
+  for (const auto& block : blocks) {
+    if (is_loaded(block.block_number) ||
+        std::ranges::find(block_numbers, block.block_number) != block_numbers.end())
+      continue;
+    auto const sector_address = ToDeviceSector(block.block_number);
+    auto const sectors_count = static_cast<uint32_t>(div_ceil(block.data_size, device_->SectorSize()));
+    // No point in reading what is already in memory.
+    if (!device_->SectorsView(sector_address, sectors_count).empty())
+      continue;
+    auto const size = size_t{sectors_count} << device_->Log2SectorSize();
+    if (prefetch_size + size > kMaxPrefetchBytes)
+      break;
+    prefetch_size += size;
+    auto& buffer = buffers.emplace_back(size);
+    block_numbers.push_back(block.block_number);
+    raw_blocks.push_back({block.block_number, buffer});
+  }
+  if (raw_blocks.empty())
+    return;
+  ReadRawBlocks(std::move(raw_blocks));
+  std::lock_guard<std::mutex> guard(state_lock_);
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    if (auto it = prefetched_blocks_.find(block_numbers[i]); it != prefetched_blocks_.end())
+      ErasePrefetchedBlock(it);
+    prefetched_bytes_ += buffers[i].size();
+    prefetched_order_.push_back(block_numbers[i]);
+    prefetched_blocks_.insert({block_numbers[i], {std::move(buffers[i]), std::prev(prefetched_order_.end())}});
+  }
+  // Blocks of other readers may be dropped before they get to them, but the budget is larger than a single batch.
+  while (prefetched_bytes_ > kMaxPrefetchedBytes)
+    ErasePrefetchedBlock(prefetched_blocks_.find(prefetched_order_.front()));
+}
+
+bool BlocksDevice::TakePrefetchedBlock(uint32_t block_number, const std::span<std::byte>& data) {
+  auto res = prefetched_blocks_.find(block_number);
+  if (res == prefetched_blocks_.end())
+    return false;
+  bool match = res->second.data.size() == data.size();
+  if (match)
+    std::ranges::copy(res->second.data, data.begin());
+  ErasePrefetchedBlock(res);
+  return match;
+}
+
+void BlocksDevice::ErasePrefetchedBlock(std::unordered_map<uint32_t, PrefetchedBlock>::iterator it) {
+  prefetched_bytes_ -= it->second.data.size();
+  prefetched_order_.erase(it->second.position);
+  prefetched_blocks_.erase(it);
+}
+
+void BlocksDevice::SetReadAheadWindow(uint32_t blocks_count) {
+  std::deque<ReadAheadWindow> dropped;
+  std::unique_lock<std::mutex> guard(state_lock_);
+  read_ahead_window_ = blocks_count;
+  read_ahead_.swap(dropped);
+  read_ahead_done_.wait(guard, [this] { return read_ahead_reads_ == 0; });
+}
+
+bool BlocksDevice::TakeReadAhead(uint32_t block_number, const std::span<std::byte>& data) {
+  auto const blocks_count = div_ceil_pow2(data.size(), log2_size(BlockSize::Physical));
+  ReadAheadWindow window;
+  {
+    std::lock_guard<std::mutex> guard(state_lock_);
+    auto res = std::ranges::find_if(read_ahead_, [&](const ReadAheadWindow& candidate) {
+      return block_number >= candidate.first_block &&
+             block_number + blocks_count <= candidate.first_block + candidate.blocks_count;
+    });
+    if (res == read_ahead_.end())
+      return false;
+    window = *res;
+  }
+  // The window holds the buffer, even if it is dropped meanwhile.
+  if (!window.loaded.get()) {
+    std::optional<ReadAheadWindow> failed;
+    std::lock_guard<std::mutex> guard(state_lock_);
+    auto res = std::ranges::find(read_ahead_, window.data, &ReadAheadWindow::data);
+    if (res != read_ahead_.end()) {
+      failed = std::move(*res);
+      read_ahead_.erase(res);
+    }
+    return false;
+  }
+  auto const offset = size_t{block_number - window.first_block} << log2_size(BlockSize::Physical);
+  std::copy(window.data->begin() + offset, window.data->begin() + offset + data.size(), data.begin());
+  return true;
+}
+
+void BlocksDevice::UpdateReadAhead(uint32_t block_number,
+                                   uint32_t blocks_count,
+                                   std::vector<ReadAheadWindow>& dropped) {
+  // Start reading ahead after a few sequential reads.
+  constexpr uint32_t kSequentialReadsForReadAhead = 2;
+  if (!read_ahead_window_)
+    return;
+  sequential_reads_ = block_number == next_sequential_block_ ? sequential_reads_ + 1 : 0;
+  next_sequential_block_ = block_number + blocks_count;
+  if (sequential_reads_ < kSequentialReadsForReadAhead)
+    return;
+  // Drop the windows that were passed.
+  while (!read_ahead_.empty() && read_ahead_.front().first_block + read_ahead_.front().blocks_count <= block_number) {
+    dropped.push_back(std::move(read_ahead_.front()));
+    read_ahead_.pop_front();
+  }
+  if (read_ahead_.empty() || block_number < read_ahead_.front().first_block) {
+    // Nothing ahead of us (or we jumped back), start from the next block.
+    std::ranges::move(read_ahead_, std::back_inserter(dropped));
+    read_ahead_.clear();
+    LaunchReadAhead(next_sequential_block_);
+  } else if (block_number >= read_ahead_.back().first_block) {
+    // Started to read the last window, read the next one.
+    LaunchReadAhead(read_ahead_.back().first_block + read_ahead_.back().blocks_count);
+  }
+}
+
+void BlocksDevice::LaunchReadAhead(uint32_t first_block) {
+  auto const device_blocks =
+      (uint64_t{device_->SectorsCount()} << device_->Log2SectorSize()) >> log2_size(BlockSize::Physical);
+  if (first_block >= device_blocks)
+    return;
+  // The reads run on the shared pool, there is no point in reading ahead without its workers.
+  auto& pool = ThreadPool::Shared();
+  if (pool.threads_count() == 0)
+    return;
+  auto const blocks_count = static_cast<uint32_t>(std::min<uint64_t>(read_ahead_window_, device_blocks - first_block));
+  auto data = std::make_shared<AlignedBuffer>(size_t{blocks_count} << log2_size(BlockSize::Physical));
+  auto loaded = std::make_shared<std::promise<bool>>();
+  read_ahead_.push_back({first_block, blocks_count, data, loaded->get_future().share()});
+  ++read_ahead_reads_;
+  // The destructor waits for the reads, so they can use the device.
+  pool.Post([this, data = std::move(data), loaded = std::move(loaded), sector_address = ToDeviceSector(first_block)] {
+    bool res = true;
+    try {
+      device_->ReadSectors(*data, sector_address, static_cast<uint32_t>(data->size() >> device_->Log2SectorSize()));
+    } catch (const std::exception&) {
+      // The blocks will be read again when they are needed.
+      res = false;
+    }
+    loaded->set_value(res);
+    std::lock_guard<std::mutex> guard(state_lock_);
+    --read_ahead_reads_;
+    // Notified with the lock, the device may be destroyed right after it is released.
+    read_ahead_done_.notify_all();
+  });
+}
+
+void BlocksDevice::DropReadAhead(uint32_t block_number,
+                                 uint32_t blocks_count,
+                                 std::vector<ReadAheadWindow>& dropped) {
+  for (auto window = read_ahead_.begin(); window != read_ahead_.end();) {
+    if (block_number < window->first_block + window->blocks_count &&
+        window->first_block < block_number + blocks_count) {
+      dropped.push_back(std::move(*window));
+      window = read_ahead_.erase(window);
+    } else {
+      ++window;
+    }
+  }
+}
+
+void BlocksDevice::ReadRawBlocks(std::vector<RawBlock> blocks) {
+  if (blocks.empty())
+    return;
+  std::ranges::sort(blocks, {}, &RawBlock::block_number);
+  // Each run of contiguous blocks is read to a staging buffer and then copied to the blocks.
+  struct Run {
+    size_t first, last;
+    AlignedBuffer buffer;
+  };
+  std::vector<Run> runs;
+  runs.reserve(blocks.size());
+  std::vector<Device::SectorsRange> ranges;
+  for (size_t first = 0; first < blocks.size();) {
+    auto const sector_address = ToDeviceSector(blocks[first].block_number);
+    auto run_end = sector_address + blocks[first].data.size() / device_->SectorSize();
+    auto last = first + 1;
+    while (last < blocks.size() && ToDeviceSector(blocks[last].block_number) == run_end) {
+      run_end += blocks[last].data.size() / device_->SectorSize();
+      ++last;
+    }
+    if (last - first == 1) {
+      ranges.push_back({blocks[first].data, sector_address});
+    } else {
+      runs.push_back({first, last, AlignedBuffer((run_end - sector_address) * device_->SectorSize())});
+      ranges.push_back({runs.back().buffer, sector_address});
+    }
+    first = last;
+  }
+  SkipHoles(ranges);
+  if (!ranges.empty())
+    device_->ReadSectorsBatch(ranges);
+  for (const auto& run : runs) {
+    auto offset = run.buffer.begin();
+    for (size_t i = run.first; i < run.last; ++i) {
+      std::copy(offset, offset + blocks[i].data.size(), blocks[i].data.begin());
+      offset += blocks[i].data.size();
+    }
+  }
+}
+
+void BlocksDevice::SkipHoles(std::vector<Device::SectorsRange>& ranges) const {
+  auto const sector_size = device_->SectorSize();
+  // Each range is queried on its own, the ranges of a batch may be spread over the whole device, with many extents
+  // between them.
+  std::erase_if(ranges, [&](const Device::SectorsRange& range) {
+    if (!device_->DataExtents(range.sector_address, static_cast<uint32_t>(range.data.size() / sector_size)).empty())
+      return false;
+    std::ranges::fill(range.data, std::byte{0});
+    return true;
+  });
 }
 
 uint32_t BlocksDevice::ToDeviceSector(uint32_t block_number) const {
@@ -61,24 +547,328 @@ uint32_t BlocksDevice::ToDeviceSector(uint32_t block_number) const {
 }
 
 std::shared_ptr<Block> BlocksDevice::GetFromCache(uint32_t block_number) {
-  auto res = blocks_cache_.find(block_number);
-  if (res == blocks_cache_.end())
-    return nullptr;
-  return std::shared_ptr<Block>(res->second);
+  return GetOrAddToCache(block_number, nullptr).block;
+}
+
+BlocksDevice::CachedBlock BlocksDevice::GetOrAddToCache(uint32_t block_number,
+                                                        const std::function<std::shared_ptr<Block>()>& create,
+                                                        bool wait) {
+  auto& shard = GetCacheShard(block_number);
+  // Created without the lock, since allocating its buffer may take a while. If another thread adds the block meanwhile,
+  // ours is destroyed after the lock is released (it is declared before the guard).
+  std::shared_ptr<Block> created;
+  std::unique_lock<std::mutex> guard(shard.lock);
+  while (true) {
+    auto res = shard.blocks.find(block_number);
+    if (res == shard.blocks.end()) {
+      if (!create)
+        return {nullptr, false, false};
+      if (!created) {
+        guard.unlock();
+        created = create();
+        guard.lock();
+        if (!created)
+          return {nullptr, false, false};
+        continue;
+      }
+      shard.blocks.insert({block_number, {created.get(), created, std::nullopt}});
+      return {std::move(created), true, false};
+    }
+    if (res->second.loaded) {
+      if (auto block = res->second.ref.lock())
+        return {std::move(block), false, !*res->second.loaded};
+    }
+    // The block is being loaded by another thread, or is being released and will be removed soon.
+    if (!wait)
+      return {nullptr, false, false};
+    shard.changed.wait(guard);
+  }
+}
+
+void BlocksDevice::AddToCache(uint32_t block_number, const std::shared_ptr<Block>& block) {
+  auto& shard = GetCacheShard(block_number);
+  std::lock_guard<std::mutex> guard(shard.lock);
+  shard.blocks[block_number] = {block.get(), block, true};
+}
+
+void BlocksDevice::SetLoaded(uint32_t block_number, const Block* block, bool loaded) {
+  auto& shard = GetCacheShard(block_number);
+  {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto res = shard.blocks.find(block_number);
+    if (res == shard.blocks.end() || res->second.block != block)
+      return;
+    res->second.loaded = loaded;
+  }
+  shard.changed.notify_all();
+}
+
+void BlocksDevice::RemoveFromCache(uint32_t block_number, const Block* block) {
+  auto& shard = GetCacheShard(block_number);
+  {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto res = shard.blocks.find(block_number);
+    // A released block may have already been replaced by a new one.
+    if (res == shard.blocks.end() || res->second.block != block)
+      return;
+    shard.blocks.erase(res);
+  }
+  shard.changed.notify_all();
 }
 
-void BlocksDevice::AddToCache(uint32_t block_number, std::weak_ptr<Block> block) {
-  blocks_cache_[block_number] = block;
+void BlocksDevice::SetRetainedCacheBudget(size_t bytes) {
+  std::lock_guard<std::mutex> guard(state_lock_);
+  retained_blocks_.SetBudget(bytes);
 }
 
-void BlocksDevice::RemoveFromCache(uint32_t block_number) {
-  auto res = blocks_cache_.find(block_number);
-  assert(res != blocks_cache_.end());
-  blocks_cache_.erase(res);
+size_t BlocksDevice::RetainedCacheSize() const {
+  std::lock_guard<std::mutex> guard(state_lock_);
+  return retained_blocks_.size();
+}
+
+void BlocksDevice::RetainBlock(uint32_t block_number, RetainedBlocksCache::Entry entry, bool reused) {
+  std::lock_guard<std::mutex> guard(state_lock_);
+  retained_blocks_.Insert(block_number, std::move(entry), reused);
+}
+
+std::optional<RetainedBlocksCache::Entry> BlocksDevice::TakeRetainedBlock(uint32_t block_number) {
+  std::lock_guard<std::mutex> guard(state_lock_);
+  return retained_blocks_.Take(block_number);
+}
+
+void BlocksDevice::SetVerifiedBlocksCapacity(size_t blocks_count) {
+  std::lock_guard<std::mutex> guard(state_lock_);
+  verified_blocks_.SetCapacity(blocks_count);
+}
+
+bool BlocksDevice::CheckBlockHash(uint32_t block_number,
+                                  std::span<const std::byte> data,
+                                  std::span<const std::byte> hash,
+                                  uint32_t iv,
+                                  bool encrypt) {
+  if (IsVerified(block_number, data, hash, iv, encrypt))
+    return true;
+  if (!DeviceEncryption::CheckHash(data, hash))
+    return false;
+  SetVerified(block_number, data, hash, iv, encrypt);
+  return true;
+}
+
+bool BlocksDevice::MaybeVerified(uint32_t block_number, size_t size, uint32_t iv, bool encrypt) const {
+  std::lock_guard<std::mutex> guard(state_lock_);
+  return verified_blocks_.Contains(block_number, static_cast<uint32_t>(size), iv, encrypt);
+}
+
+bool BlocksDevice::IsVerified(uint32_t block_number,
+                              std::span<const std::byte> data,
+                              std::span<const std::byte> hash,
+                              uint32_t iv,
+                              bool encrypt) const {
+  std::lock_guard<std::mutex> guard(state_lock_);
+  return verified_blocks_.Contains(block_number, VerifiedEntry(data, hash, iv, encrypt));
+}
+
+void BlocksDevice::SetVerified(uint32_t block_number,
+                               std::span<const std::byte> data,
+                               std::span<const std::byte> hash,
+                               uint32_t iv,
+                               bool encrypt) {
+  std::lock_guard<std::mutex> guard(state_lock_);
+  verified_blocks_.Insert(block_number, VerifiedEntry(data, hash, iv, encrypt));
+}
+
+void BlocksDevice::AddDirtyBlock(Block* block) {
+  std::lock_guard<std::mutex> guard(dirty_blocks_lock_);
+  assert(!block->prev_dirty_ && block != dirty_blocks_);
+  block->next_dirty_ = dirty_blocks_;
+  if (dirty_blocks_)
+    dirty_blocks_->prev_dirty_ = block;
+  dirty_blocks_ = block;
+}
+
+void BlocksDevice::RemoveDirtyBlock(Block* block) {
+  std::lock_guard<std::mutex> guard(dirty_blocks_lock_);
+  if (block->prev_dirty_) {
+    block->prev_dirty_->next_dirty_ = block->next_dirty_;
+  } else if (dirty_blocks_ == block) {
+    dirty_blocks_ = block->next_dirty_;
+  } else {
+    return;
+  }
+  if (block->next_dirty_)
+    block->next_dirty_->prev_dirty_ = block->prev_dirty_;
+  block->prev_dirty_ = block->next_dirty_ = nullptr;
 }
 
 void BlocksDevice::FlushAll() {
-  for (auto& [block_number, block_weak] : blocks_cache_) {
-    std::shared_ptr<Block>(block_weak)->Flush();
+  std::vector<std::shared_ptr<Block>> blocks;
+  {
+    std::lock_guard<std::mutex> guard(dirty_blocks_lock_);
+    for (auto* block = dirty_blocks_; block; block = block->next_dirty_) {
+      // A block that is being released flushes itself.
+      if (auto ref = block->weak_from_this().lock())
+        blocks.push_back(std::move(ref));
+    }
+  }
+  Block::FlushBlocks(blocks);
+  WritePendingWrites();
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> guard(writeback_lock_);
+    std::swap(error, writeback_error_);
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void BlocksDevice::StartWriteback(WritebackOptions options) {
+  std::lock_guard<std::mutex> guard(writeback_lock_);
+  writeback_options_ = options;
+  if (writeback_thread_.joinable()) {
+    writeback_changed_.notify_all();
+    return;
+  }
+  stop_writeback_ = false;
+  writeback_enabled_ = true;
+  writeback_thread_ = std::thread(&BlocksDevice::WritebackThread, this);
+}
+
+void BlocksDevice::StopWriteback() {
+  {
+    std::lock_guard<std::mutex> guard(writeback_lock_);
+    if (!writeback_thread_.joinable())
+      return;
+    writeback_enabled_ = false;
+    stop_writeback_ = true;
+  }
+  writeback_changed_.notify_all();
+  writeback_thread_.join();
+  WritePendingWrites();
+}
+
+void BlocksDevice::QueueWrite(uint32_t block_number,
+                              BlockBuffer data,
+                              uint32_t iv,
+                              bool encrypt,
+                              uint32_t dirty_offset) {
+  auto write = std::make_shared<PendingWrite>(PendingWrite{std::move(data), iv, encrypt, dirty_offset});
+  std::unique_lock<std::mutex> guard(writeback_lock_);
+  if (!writeback_thread_.joinable() || stop_writeback_) {
+    // The writeback was stopped in the meantime.
+    guard.unlock();
+    BlockWrite block{block_number, write->data, {}, iv, encrypt, /*recalculate_hash=*/false, dirty_offset};
+    WriteBlocks({&block, 1});
+    return;
+  }
+  // The thread waits for the first write, and then for its deadline or for enough writes.
+  bool const notify =
+      pending_writes_.empty() || pending_bytes_ + write->data.size() >= writeback_options_.background_bytes;
+  if (pending_writes_.empty())
+    oldest_pending_write_ = std::chrono::steady_clock::now();
+  auto& pending_write = pending_writes_[block_number];
+  if (pending_write) {
+    pending_bytes_ -= pending_write->data.size();
+    // The replaced write didn't reach the device either.
+    write->dirty_offset = pending_write->data.size() == write->data.size()
+                              ? std::min(write->dirty_offset, pending_write->dirty_offset)
+                              : 0;
+  }
+  pending_bytes_ += write->data.size();
+  pending_write = std::move(write);
+  if (notify)
+    writeback_changed_.notify_all();
+  // Only wait when the limit is exceeded.
+  writeback_changed_.wait(guard,
+                          [this] { return pending_bytes_ <= writeback_options_.limit_bytes || stop_writeback_; });
+}
+
+bool BlocksDevice::ReadPendingWrite(uint32_t block_number, const std::span<std::byte>& data) const {
+  return ReadPendingWrite(block_number, static_cast<uint32_t>(data.size()), 0, data);
+}
+
+bool BlocksDevice::ReadPendingWrite(uint32_t block_number,
+                                    uint32_t block_size,
+                                    uint32_t offset,
+                                    const std::span<std::byte>& data) const {
+  std::lock_guard<std::mutex> guard(writeback_lock_);
+  auto res = pending_writes_.find(block_number);
+  if (res == pending_writes_.end() || res->second->data.size() != block_size)
+    return false;
+  std::copy_n(res->second->data.begin() + offset, data.size(), data.begin());
+  return true;
+}
+
+bool BlocksDevice::CancelPendingWrites(uint32_t block_number, uint32_t blocks_count) {
+  std::lock_guard<std::mutex> guard(writeback_lock_);
+  if (pending_writes_.empty())
+    return false;
+  bool cancelled = false;
+  EraseOverlappingBlocks(
+      pending_writes_, block_number, blocks_count,
+      [](const std::shared_ptr<PendingWrite>& write) {
+        return div_ceil_pow2(write->data.size(), log2_size(BlockSize::Physical));
+      },
+      [&](auto it) {
+        pending_bytes_ -= it->second->data.size();
+        pending_writes_.erase(it);
+        cancelled = true;
+      });
+  writeback_changed_.notify_all();
+  return cancelled;
+}
+
+void BlocksDevice::WritePendingWrites() {
+  std::lock_guard<std::mutex> writeback_guard(writeback_io_lock_);
+  std::vector<std::pair<uint32_t, std::shared_ptr<PendingWrite>>> writes;
+  {
+    std::lock_guard<std::mutex> guard(writeback_lock_);
+    writes.assign(pending_writes_.begin(), pending_writes_.end());
+  }
+  if (writes.empty())
+    return;
+  std::vector<BlockWrite> blocks;
+  blocks.reserve(writes.size());
+  for (const auto& [block_number, write] : writes)
+    blocks.push_back(
+        {block_number, write->data, {}, write->iv, write->encrypt, /*recalculate_hash=*/false, write->dirty_offset});
+  std::exception_ptr error;
+  try {
+    WriteBlocksToDevice(blocks);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  {
+    std::lock_guard<std::mutex> guard(writeback_lock_);
+    // A failed write is dropped too, its error is reported by the next FlushAll.
+    for (const auto& [block_number, write] : writes) {
+      auto res = pending_writes_.find(block_number);
+      if (res != pending_writes_.end() && res->second == write) {
+        pending_bytes_ -= write->data.size();
+        pending_writes_.erase(res);
+      }
+    }
+    if (!pending_writes_.empty())
+      oldest_pending_write_ = std::chrono::steady_clock::now();
+    if (error)
+      writeback_error_ = error;
+  }
+  writeback_changed_.notify_all();
+}
+
+void BlocksDevice::WritebackThread() {
+  std::unique_lock<std::mutex> guard(writeback_lock_);
+  while (!stop_writeback_) {
+    if (pending_writes_.empty()) {
+      writeback_changed_.wait(guard);
+      continue;
+    }
+    auto const deadline = oldest_pending_write_ + writeback_options_.max_age;
+    if (pending_bytes_ < writeback_options_.background_bytes && std::chrono::steady_clock::now() < deadline) {
+      writeback_changed_.wait_until(guard, deadline);
+      continue;
+    }
+    guard.unlock();
+    WritePendingWrites();
+    guard.lock();
   }
 }
@@ -9,41 +9,64 @@
 
 #include <cryptopp/aes.h>
 #include <cryptopp/modes.h>
-#include <cryptopp/sha.h>
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <cstring>
 
 #include "device.h"
+#include "sha1.h"
+#include "thread_pool.h"
 #include "utils.h"
 
+static_assert(DeviceEncryption::kCipherBlockSize == CryptoPP::AES::BLOCKSIZE);
+
 struct WfsBlockIV {
   uint32_be_t iv[4];
 };
 
+struct DeviceEncryption::Ciphers {
+  CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption encryption;
+  CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryption;
+  // The raw block cipher, for the interleaved encryption of several blocks.
+  CryptoPP::AES::Encryption block_encryption;
+};
+
 DeviceEncryption::DeviceEncryption(std::shared_ptr<Device> device, std::vector<std::byte> key)
     : device_(device), key_(std::move(key)) {}
 
-// static
-void DeviceEncryption::HashData(std::initializer_list<std::span<const std::byte>> data,
-                                const std::span<std::byte>& hash) {
-  // Pad and hash
-  CryptoPP::SHA1 sha1;
-  for (auto& data_part : data) {
-    sha1.Update(reinterpret_cast<const uint8_t*>(data_part.data()), data_part.size());
-  }
-  sha1.Final(reinterpret_cast<uint8_t*>(hash.data()));
+DeviceEncryption::~DeviceEncryption() = default;
+
+namespace {
+// A hash that is stored in the block is hashed as 0xFF bytes.
+size_t PlaceholderOffset(std::span<const std::byte> data, std::span<const std::byte> hash) {
+  bool hash_in_block = data.size() >= hash.size() && data.data() <= hash.data() &&
+                       hash.data() + hash.size() <= data.data() + data.size();
+  return hash_in_block ? static_cast<size_t>(hash.data() - data.data()) : Sha1::kNoPlaceholder;
+}
+
+Sha1::BlockHash MakeBlockHash(std::span<const std::byte> data,
+                              std::span<std::byte> digest,
+                              std::span<const std::byte> hash) {
+  return {data, PlaceholderOffset(data, hash), digest};
 }
+}  // namespace
 
 // static
 void DeviceEncryption::CalculateHash(const std::span<const std::byte>& data, const std::span<std::byte>& hash) {
-  bool hash_in_block = data.size() >= hash.size() && data.data() <= hash.data() &&
-                       hash.data() + hash.size() <= data.data() + data.size();
-  // Fill hash space with 0xFF
-  if (hash_in_block)
-    std::ranges::fill(hash, std::byte{0xFF});
+  Sha1::Hash(MakeBlockHash(data, hash, hash));
+}
 
-  HashData({data}, hash);
+// static
+void DeviceEncryption::CalculateHashes(std::span<const std::span<const std::byte>> data,
+                                       std::span<const std::span<std::byte>> hashes) {
+  assert(data.size() == hashes.size());
+  std::vector<Sha1::BlockHash> blocks;
+  blocks.reserve(data.size());
+  for (size_t i = 0; i < data.size(); ++i)
+    blocks.push_back(MakeBlockHash(data[i], hashes[i], hashes[i]));
+  Sha1::HashBlocks(blocks);
 }
 
 void DeviceEncryption::EncryptBlock(const std::span<std::byte>& data, uint32_t iv) {
@@ -51,9 +74,72 @@ void DeviceEncryption::EncryptBlock(const std::span<std::byte>& data, uint32_t i
   auto const sectors_count = static_cast<uint32_t>(data.size() / device_->SectorSize());
 
   auto _iv = GetIV(sectors_count, iv);
-  CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption encryptor(reinterpret_cast<const uint8_t*>(key_.data()), key_.size(),
-                                                          reinterpret_cast<uint8_t*>(&_iv));
-  encryptor.ProcessData(reinterpret_cast<uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(data.data()), data.size());
+  auto ciphers = AcquireCiphers();
+  ciphers->encryption.Resynchronize(reinterpret_cast<uint8_t*>(&_iv));
+  ciphers->encryption.ProcessData(reinterpret_cast<uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(data.data()),
+                                  data.size());
+  ReleaseCiphers(std::move(ciphers));
+}
+
+void DeviceEncryption::EncryptBlocks(std::span<const BlockRef> blocks) {
+  // Number of blocks that are encrypted side by side, enough to keep the AES pipeline full.
+  constexpr size_t kLanes = 8;
+  constexpr size_t kAesBlockSize = CryptoPP::AES::BLOCKSIZE;
+  struct Lane {
+    std::byte* data;
+    size_t remaining;
+    std::array<uint8_t, kAesBlockSize> chain;
+  };
+  std::array<Lane, kLanes> lanes;
+  alignas(16) std::array<uint8_t, kLanes * kAesBlockSize> input;
+  alignas(16) std::array<uint8_t, kLanes * kAesBlockSize> chains;
+  alignas(16) std::array<uint8_t, kLanes * kAesBlockSize> output;
+
+  auto ciphers = AcquireCiphers();
+  size_t active = 0;
+  auto next_block = blocks.begin();
+  while (true) {
+    // Each finished lane is refilled with the next block.
+    for (; active < kLanes && next_block != blocks.end(); ++next_block) {
+      assert(next_block->data.size() % device_->SectorSize() == 0);
+      if (next_block->data.empty())
+        continue;
+      auto& lane = lanes[active++];
+      lane.data = next_block->data.data();
+      lane.remaining = next_block->data.size();
+      if (next_block->previous_cipher_block) {
+        std::memcpy(lane.chain.data(), next_block->previous_cipher_block, kAesBlockSize);
+      } else {
+        auto const iv = GetIV(static_cast<uint32_t>(lane.remaining / device_->SectorSize()), next_block->iv);
+        std::memcpy(lane.chain.data(), &iv, kAesBlockSize);
+      }
+    }
+    if (active == 0)
+      break;
+
+    // CBC: out = E(plain ^ previous cipher block), computed for one AES block of each lane at once.
+    for (size_t i = 0; i < active; ++i) {
+      std::memcpy(input.data() + i * kAesBlockSize, lanes[i].data, kAesBlockSize);
+      std::memcpy(chains.data() + i * kAesBlockSize, lanes[i].chain.data(), kAesBlockSize);
+    }
+    ciphers->block_encryption.AdvancedProcessBlocks(
+        input.data(), chains.data(), output.data(), active * kAesBlockSize,
+        CryptoPP::BlockTransformation::BT_XorInput | CryptoPP::BlockTransformation::BT_AllowParallel);
+    for (size_t i = 0; i < active; ++i) {
+      auto& lane = lanes[i];
+      std::memcpy(lane.data, output.data() + i * kAesBlockSize, kAesBlockSize);
+      std::memcpy(lane.chain.data(), output.data() + i * kAesBlockSize, kAesBlockSize);
+      lane.data += kAesBlockSize;
+      lane.remaining -= kAesBlockSize;
+    }
+    for (size_t i = 0; i < active;) {
+      if (lanes[i].remaining == 0)
+        lanes[i] = lanes[--active];
+      else
+        ++i;
+    }
+  }
+  ReleaseCiphers(std::move(ciphers));
 }
 
 void DeviceEncryption::DecryptBlock(const std::span<std::byte>& data, uint32_t iv) const {
@@ -61,29 +147,160 @@ void DeviceEncryption::DecryptBlock(const std::span<std::byte>& data, uint32_t i
   auto const sectors_count = static_cast<uint32_t>(data.size() / device_->SectorSize());
 
   auto _iv = GetIV(sectors_count, iv);
-  CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryptor(reinterpret_cast<const uint8_t*>(key_.data()), key_.size(),
-                                                          reinterpret_cast<uint8_t*>(&_iv));
-  decryptor.ProcessData(reinterpret_cast<uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(data.data()), data.size());
+  auto& pool = ThreadPool::Shared();
+  if (data.size() < 2 * kParallelDecryptChunkSize || pool.threads_count() == 0) {
+    DecryptChunk(data, reinterpret_cast<const uint8_t*>(&_iv));
+    return;
+  }
+
+  auto const chunks_ivs = ParallelChunksIVs(data, _iv);
+  pool.ParallelFor(chunks_ivs.size(), [&](size_t i) { DecryptChunk(ParallelChunk(data, i), chunks_ivs[i].data()); });
 }
 
-// static
-bool DeviceEncryption::CheckHash(const std::span<const std::byte>& data, const std::span<const std::byte>& hash) {
-  bool hash_in_block = data.size() >= hash.size() && data.data() <= hash.data() &&
-                       hash.data() + hash.size() <= data.data() + data.size();
+void DeviceEncryption::DecryptBlockRange(const std::span<std::byte>& data,
+                                         size_t block_size,
+                                         uint32_t iv,
+                                         const std::byte* previous_cipher_block) const {
+  assert(data.size() % device_->SectorSize() == 0 && block_size % device_->SectorSize() == 0);
+  ChunkIV chain;
+  if (previous_cipher_block) {
+    std::memcpy(chain.data(), previous_cipher_block, chain.size());
+  } else {
+    auto const _iv = GetIV(static_cast<uint32_t>(block_size / device_->SectorSize()), iv);
+    std::memcpy(chain.data(), &_iv, chain.size());
+  }
+  DecryptChunk(data, chain.data());
+}
 
-  std::array<std::byte, DIGEST_SIZE> calculated_hash;
-  if (hash_in_block) {
-    std::array<std::byte, DIGEST_SIZE> placeholder_hash;
-    placeholder_hash.fill(std::byte{0xFF});
-    HashData({{data.data(), hash.data()}, placeholder_hash, {hash.data() + hash.size(), data.data() + data.size()}},
-             calculated_hash);
+bool DeviceEncryption::DecryptBlockAndCheckHash(const std::span<std::byte>& data,
+                                                uint32_t iv,
+                                                const std::span<const std::byte>& hash) const {
+  assert(data.size() % device_->SectorSize() == 0);
+  auto const sectors_count = static_cast<uint32_t>(data.size() / device_->SectorSize());
+
+  auto _iv = GetIV(sectors_count, iv);
+  Sha1::Stream sha1(PlaceholderOffset(data, hash));
+  auto& pool = ThreadPool::Shared();
+  if (data.size() < 2 * kParallelDecryptChunkSize || pool.threads_count() == 0) {
+    // Each piece is hashed right after it is decrypted, while it is still in the cache.
+    auto ciphers = AcquireCiphers();
+    ciphers->decryption.Resynchronize(reinterpret_cast<uint8_t*>(&_iv));
+    for (size_t offset = 0; offset < data.size(); offset += kFusedDecryptChunkSize) {
+      auto chunk = data.subspan(offset, std::min(kFusedDecryptChunkSize, data.size() - offset));
+      auto* chunk_data = reinterpret_cast<uint8_t*>(chunk.data());
+      ciphers->decryption.ProcessData(chunk_data, chunk_data, chunk.size());
+      sha1.Update(chunk);
+    }
+    ReleaseCiphers(std::move(ciphers));
   } else {
-    HashData({data}, calculated_hash);
+    // Same chunks as DecryptBlock, task 0 hashes them in order while the other tasks decrypt them. Whichever thread
+    // takes task 0 first, the caller or a worker, waits in it, and the chunks are decrypted by the other threads of
+    // the job. If the caller is the one waiting and the workers are busy with other jobs, the chunks are only
+    // decrypted once a worker is free (the pool has at least one worker here).
+    auto const chunks_ivs = ParallelChunksIVs(data, _iv);
+    auto const chunks_count = chunks_ivs.size();
+    std::vector<std::atomic<bool>> decrypted(chunks_count);
+    pool.ParallelFor(chunks_count + 1, [&](size_t task) {
+      if (task == 0) {
+        for (size_t i = 0; i < chunks_count; ++i) {
+          decrypted[i].wait(false);
+          sha1.Update(ParallelChunk(data, i));
+        }
+        return;
+      }
+      auto const i = task - 1;
+      // Marked even if the decryption throws, so the hashing task doesn't wait forever.
+      struct MarkDecrypted {
+        std::atomic<bool>& flag;
+        ~MarkDecrypted() {
+          flag = true;
+          flag.notify_one();
+        }
+      } mark_decrypted{decrypted[i]};
+      DecryptChunk(ParallelChunk(data, i), chunks_ivs[i].data());
+    });
+  }
+
+  std::array<std::byte, DIGEST_SIZE> calculated_hash;
+  sha1.Final(calculated_hash);
+  return std::ranges::equal(calculated_hash, hash);
+}
+
+// static
+std::vector<DeviceEncryption::ChunkIV> DeviceEncryption::ParallelChunksIVs(std::span<const std::byte> data,
+                                                                           const WfsBlockIV& iv) {
+  // Unlike encryption, CBC decryption of a chunk only depends on the last cipher block of the previous chunk, so the
+  // chunks are independent once those are saved (the decryption is in place).
+  std::vector<ChunkIV> chunks_ivs(div_ceil(data.size(), kParallelDecryptChunkSize));
+  std::memcpy(chunks_ivs[0].data(), &iv, CryptoPP::AES::BLOCKSIZE);
+  for (size_t i = 1; i < chunks_ivs.size(); ++i)
+    std::memcpy(chunks_ivs[i].data(), data.data() + i * kParallelDecryptChunkSize - CryptoPP::AES::BLOCKSIZE,
+                CryptoPP::AES::BLOCKSIZE);
+  return chunks_ivs;
+}
+
+// static
+std::span<std::byte> DeviceEncryption::ParallelChunk(std::span<std::byte> data, size_t index) {
+  auto const offset = index * kParallelDecryptChunkSize;
+  return data.subspan(offset, std::min(kParallelDecryptChunkSize, data.size() - offset));
+}
+
+void DeviceEncryption::DecryptChunk(const std::span<std::byte>& data, const uint8_t* iv) const {
+  auto ciphers = AcquireCiphers();
+  ciphers->decryption.Resynchronize(iv);
+  ciphers->decryption.ProcessData(reinterpret_cast<uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(data.data()),
+                                  data.size());
+  ReleaseCiphers(std::move(ciphers));
+}
+
+std::unique_ptr<DeviceEncryption::Ciphers> DeviceEncryption::AcquireCiphers() const {
+  {
+    std::lock_guard<std::mutex> guard(ciphers_lock_);
+    if (!free_ciphers_.empty()) {
+      auto ciphers = std::move(free_ciphers_.back());
+      free_ciphers_.pop_back();
+      return ciphers;
+    }
   }
+  // Expanding the key schedule is the expensive part, it is done once per ciphers object.
+  // CBC mode requires an IV when it is keyed, it is replaced for each block anyway.
+  const std::array<uint8_t, CryptoPP::AES::BLOCKSIZE> iv{};
+  auto ciphers = std::make_unique<Ciphers>();
+  ciphers->encryption.SetKeyWithIV(reinterpret_cast<const uint8_t*>(key_.data()), key_.size(), iv.data());
+  ciphers->decryption.SetKeyWithIV(reinterpret_cast<const uint8_t*>(key_.data()), key_.size(), iv.data());
+  ciphers->block_encryption.SetKey(reinterpret_cast<const uint8_t*>(key_.data()), key_.size());
+  return ciphers;
+}
+
+void DeviceEncryption::ReleaseCiphers(std::unique_ptr<Ciphers> ciphers) const {
+  std::lock_guard<std::mutex> guard(ciphers_lock_);
+  free_ciphers_.push_back(std::move(ciphers));
+}
 
+// static
+bool DeviceEncryption::CheckHash(const std::span<const std::byte>& data, const std::span<const std::byte>& hash) {
+  std::array<std::byte, DIGEST_SIZE> calculated_hash;
+  Sha1::Hash(MakeBlockHash(data, calculated_hash, hash));
   return std::ranges::equal(calculated_hash, hash);
 }
 
+// static
+std::vector<bool> DeviceEncryption::CheckHashes(std::span<const std::span<const std::byte>> data,
+                                                std::span<const std::span<const std::byte>> hashes) {
+  assert(data.size() == hashes.size());
+  std::vector<std::array<std::byte, DIGEST_SIZE>> calculated_hashes(data.size());
+  std::vector<Sha1::BlockHash> blocks;
+  blocks.reserve(data.size());
+  for (size_t i = 0; i < data.size(); ++i)
+    blocks.push_back(MakeBlockHash(data[i], calculated_hashes[i], hashes[i]));
+  Sha1::HashBlocks(blocks);
+  std::vector<bool> results;
+  results.reserve(data.size());
+  for (size_t i = 0; i < data.size(); ++i)
+    results.push_back(std::ranges::equal(calculated_hashes[i], hashes[i]));
+  return results;
+}
+
 WfsBlockIV DeviceEncryption::GetIV(uint32_t sectors_count, uint32_t iv) const {
   WfsBlockIV aes_iv;
   aes_iv.iv[0] = sectors_count * device_->SectorSize();
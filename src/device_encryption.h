@@ -7,33 +7,84 @@
 
 #pragma once
 
-#include <cryptopp/sha.h>
+#include <array>
 #include <memory>
+#include <mutex>
 #include <span>
 #include <vector>
 
+#include "sha1.h"
+
 class Device;
 struct WfsBlockIV;
 
 class DeviceEncryption {
  public:
   DeviceEncryption(std::shared_ptr<Device> device, std::vector<std::byte> key);
+  ~DeviceEncryption();
+
+  struct BlockRef {
+    std::span<std::byte> data;
+    uint32_t iv;
+    // Set if |data| is the tail of a block, to the cipher block before it, which it is chained to instead of the iv.
+    const std::byte* previous_cipher_block;
+  };
 
   void EncryptBlock(const std::span<std::byte>& data, uint32_t iv);
+  // Same as EncryptBlock for each block, but the independent blocks are interleaved to keep the AES units busy.
+  void EncryptBlocks(std::span<const BlockRef> blocks);
   void DecryptBlock(const std::span<std::byte>& data, uint32_t iv) const;
+  // Decrypts some of the sectors of a block of |block_size| bytes. They are chained to |previous_cipher_block|, the
+  // last cipher block of the sector before them, or to the iv if they are at the start of the block (nullptr).
+  void DecryptBlockRange(const std::span<std::byte>& data,
+                         size_t block_size,
+                         uint32_t iv,
+                         const std::byte* previous_cipher_block) const;
+  // DecryptBlock and CheckHash in a single pass over the data.
+  bool DecryptBlockAndCheckHash(const std::span<std::byte>& data,
+                                uint32_t iv,
+                                const std::span<const std::byte>& hash) const;
 
   static void CalculateHash(const std::span<const std::byte>& data, const std::span<std::byte>& hash);
   static bool CheckHash(const std::span<const std::byte>& data, const std::span<const std::byte>& hash);
+  // Batch variants, the blocks are hashed together with the fastest kernel (see Sha1).
+  static void CalculateHashes(std::span<const std::span<const std::byte>> data,
+                              std::span<const std::span<std::byte>> hashes);
+  static std::vector<bool> CheckHashes(std::span<const std::span<const std::byte>> data,
+                                       std::span<const std::span<const std::byte>> hashes);
 
   std::shared_ptr<const Device> device() { return device_; }
 
-  static constexpr size_t DIGEST_SIZE = CryptoPP::SHA1::DIGESTSIZE;
+  static constexpr size_t DIGEST_SIZE = Sha1::DIGEST_SIZE;
+  // AES block size, blocks are encrypted with AES-CBC.
+  static constexpr size_t kCipherBlockSize = 16;
+
+  // Blocks of at least two chunks are decrypted chunk by chunk in parallel, on the shared thread pool.
+  static constexpr size_t kParallelDecryptChunkSize = 64 * 1024;
+  // Pieces that are decrypted and then hashed while they are still in the L1 cache.
+  static constexpr size_t kFusedDecryptChunkSize = 16 * 1024;
 
  private:
-  static void HashData(std::initializer_list<std::span<const std::byte>> data, const std::span<std::byte>& hash);
+  // Keyed AES-CBC encryption and decryption, reused for every block with only the IV changed.
+  struct Ciphers;
+
+  // Takes keyed ciphers from the free list, or keys new ones if all of them are in use by other threads.
+  std::unique_ptr<Ciphers> AcquireCiphers() const;
+  void ReleaseCiphers(std::unique_ptr<Ciphers> ciphers) const;
+
+  using ChunkIV = std::array<uint8_t, kCipherBlockSize>;
+
+  void DecryptChunk(const std::span<std::byte>& data, const uint8_t* iv) const;
+  // The IV of each kParallelDecryptChunkSize chunk of an encrypted block, saved before it is decrypted in place.
+  static std::vector<ChunkIV> ParallelChunksIVs(std::span<const std::byte> data, const WfsBlockIV& iv);
+  static std::span<std::byte> ParallelChunk(std::span<std::byte> data, size_t index);
+
   WfsBlockIV GetIV(uint32_t sectors_count, uint32_t iv) const;
 
   std::shared_ptr<Device> device_;
 
   const std::vector<std::byte> key_;
+
+  mutable std::mutex ciphers_lock_;
+  mutable std::vector<std::unique_ptr<Ciphers>> free_ciphers_;
 };
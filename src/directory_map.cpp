@@ -19,7 +19,7 @@ DirectoryMap::DirectoryMap(std::shared_ptr<QuotaArea> quota, std::shared_ptr<Blo
 
 DirectoryMap::iterator DirectoryMap::begin() const {
   auto current_block = root_block_;
-  std::vector<iterator::parent_node_info> parents;
+  iterator::parents_stack parents;
   while (!(current_block->get_object<MetadataBlockHeader>(0)->block_flags.value() &
            MetadataBlockHeader::Flags::DIRECTORY_LEAF_TREE)) {
     parents.push_back({std::move(current_block)});
@@ -34,7 +34,7 @@ DirectoryMap::iterator DirectoryMap::begin() const {
 
 DirectoryMap::iterator DirectoryMap::end() const {
   auto current_block = root_block_;
-  std::vector<iterator::parent_node_info> parents;
+  iterator::parents_stack parents;
   while (!(current_block->get_object<MetadataBlockHeader>(0)->block_flags.value() &
            MetadataBlockHeader::Flags::DIRECTORY_LEAF_TREE)) {
     parents.push_back({std::move(current_block)});
@@ -87,7 +87,7 @@ Block::DataRef<EntryMetadata> DirectoryMap::realloc_metadata(iterator it, size_t
 
 DirectoryMap::iterator DirectoryMap::find(std::string_view key) const {
   auto current_block = root_block_;
-  std::vector<iterator::parent_node_info> parents;
+  iterator::parents_stack parents;
   while (!(current_block->get_object<MetadataBlockHeader>(0)->block_flags.value() &
            MetadataBlockHeader::Flags::DIRECTORY_LEAF_TREE)) {
     parents.push_back({std::move(current_block)});
@@ -220,7 +220,7 @@ std::expected<Block::DataRef<EntryMetadata>, WfsError> DirectoryMap::replace_met
 }
 
 template <DirectoryTreeImpl TreeType>
-bool DirectoryMap::split_tree(std::vector<iterator::parent_node_info>& parents,
+bool DirectoryMap::split_tree(iterator::parents_stack& parents,
                               TreeType& tree,
                               std::string_view for_key) {
   auto old_block = tree.block();
@@ -39,7 +39,7 @@ class DirectoryMap : public std::enable_shared_from_this<DirectoryMap> {
 
  private:
   template <DirectoryTreeImpl TreeType>
-  bool split_tree(std::vector<iterator::parent_node_info>& parents, TreeType& tree, std::string_view for_key);
+  bool split_tree(iterator::parents_stack& parents, TreeType& tree, std::string_view for_key);
   Block::DataRef<EntryMetadata> alloc_metadata(iterator it, size_t log2_size);
   Block::DataRef<EntryMetadata> realloc_metadata(iterator it, size_t log2_size);
 
@@ -10,7 +10,7 @@
 #include "quota_area.h"
 
 DirectoryMapIterator::DirectoryMapIterator(std::shared_ptr<QuotaArea> quota,
-                                           std::vector<parent_node_info> parents,
+                                           parents_stack parents,
                                            leaf_node_info leaf)
     : quota_(quota), parents_(std::move(parents)), leaf_(std::move(leaf)) {}
 
@@ -22,7 +22,7 @@ DirectoryMapIterator::reference DirectoryMapIterator::operator*() const {
 DirectoryMapIterator& DirectoryMapIterator::operator++() {
   assert(!is_end());
   if ((++leaf_.iterator).is_end()) {
-    std::vector<parent_node_info> removed_parents;
+    parents_stack removed_parents;
     while (!parents_.empty() && (++parents_.back().iterator).is_end()) {
       removed_parents.push_back(std::move(parents_.back()));
       parents_.pop_back();
@@ -35,12 +35,17 @@ DirectoryMapIterator& DirectoryMapIterator::operator++() {
       }
       return *this;
     }
+    if (!removed_parents.empty())
+      prefetched_children_ = 0;
+    PrefetchChildren();
     auto current_block = throw_if_error(quota_->LoadMetadataBlock((*parents_.back().iterator).value()));
     while (!(current_block->get_object<MetadataBlockHeader>(0)->block_flags.value() &
              MetadataBlockHeader::Flags::DIRECTORY_LEAF_TREE)) {
       parents_.push_back({std::move(current_block)});
       parents_.back().iterator = parents_.back().node.begin();
       assert(!parents_.back().iterator.is_end());
+      prefetched_children_ = 0;
+      PrefetchChildren();
       current_block = throw_if_error(quota_->LoadMetadataBlock((*parents_.back().iterator).value()));
     }
     leaf_ = {std::move(current_block)};
@@ -52,8 +57,10 @@ DirectoryMapIterator& DirectoryMapIterator::operator++() {
 
 DirectoryMapIterator& DirectoryMapIterator::operator--() {
   assert(!is_begin());
+  // Only forward scans are prefetched.
+  prefetched_children_ = 0;
   if (leaf_.iterator.is_begin()) {
-    std::vector<parent_node_info> removed_parents;
+    parents_stack removed_parents;
     while (!parents_.empty() && parents_.back().iterator.is_begin()) {
       removed_parents.push_back(std::move(parents_.back()));
       parents_.pop_back();
@@ -93,6 +100,20 @@ DirectoryMapIterator DirectoryMapIterator::operator--(int) {
   return tmp;
 }
 
+void DirectoryMapIterator::PrefetchChildren() {
+  if (prefetched_children_ > 0) {
+    --prefetched_children_;
+    return;
+  }
+  std::vector<uint32_t> block_numbers;
+  for (auto it = parents_.back().iterator; !it.is_end() && block_numbers.size() < kPrefetchChildrenCount; ++it)
+    block_numbers.push_back((*it).value());
+  // A single block gains nothing from a batch.
+  if (block_numbers.size() > 1)
+    quota_->PrefetchMetadataBlocks(block_numbers);
+  prefetched_children_ = block_numbers.size() - 1;
+}
+
 bool DirectoryMapIterator::is_begin() const {
   return leaf_.iterator.is_begin() &&
          std::ranges::all_of(parents_, [](const auto& node) { return node.iterator.is_begin(); });
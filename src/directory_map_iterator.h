@@ -10,6 +10,7 @@
 #include "block.h"
 #include "directory_leaf_tree.h"
 #include "directory_parent_tree.h"
+#include "small_vector.h"
 
 class QuotaArea;
 struct EntryMetadata;
@@ -32,8 +33,11 @@ class DirectoryMapIterator {
   using parent_node_info = dir_node_iterator_info<DirectoryParentTree>;
   using leaf_node_info = dir_node_iterator_info<DirectoryLeafTree>;
 
+  // One level per metadata block, directories with more levels than that are huge.
+  using parents_stack = SmallVector<parent_node_info, 4>;
+
   DirectoryMapIterator() = default;
-  DirectoryMapIterator(std::shared_ptr<QuotaArea> quota, std::vector<parent_node_info> parents, leaf_node_info leaf);
+  DirectoryMapIterator(std::shared_ptr<QuotaArea> quota, parents_stack parents, leaf_node_info leaf);
 
   reference operator*() const;
 
@@ -44,8 +48,8 @@ class DirectoryMapIterator {
 
   bool operator==(const DirectoryMapIterator& other) const { return leaf_.iterator == other.leaf_.iterator; }
 
-  std::vector<parent_node_info>& parents() { return parents_; };
-  const std::vector<parent_node_info>& parents() const { return parents_; };
+  parents_stack& parents() { return parents_; };
+  const parents_stack& parents() const { return parents_; };
   leaf_node_info& leaf() { return leaf_; };
   const leaf_node_info& leaf() const { return leaf_; };
 
@@ -55,7 +59,16 @@ class DirectoryMapIterator {
   bool is_end() const { return leaf_.iterator.is_end(); }
 
  private:
+  // Blocks of the children of the deepest parent that a forward scan reads in one batch.
+  static constexpr size_t kPrefetchChildrenCount = 32;
+
+  // Prefetches the blocks of the next children of the deepest parent, starting at its iterator, unless they already
+  // were by a previous call.
+  void PrefetchChildren();
+
   std::shared_ptr<QuotaArea> quota_;
-  std::vector<parent_node_info> parents_;
+  parents_stack parents_;
   leaf_node_info leaf_;
+  // Children of the deepest parent after its iterator that were already prefetched.
+  size_t prefetched_children_{0};
 };
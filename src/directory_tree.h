@@ -31,7 +31,7 @@ class DirectoryTree : public SubBlockAllocator<DirectoryTreeHeader> {
   iterator begin() const {
     if (size() == 0)
       return {block().get(), {}, {}};
-    std::vector<typename iterator::parent_node_info> parents;
+    typename iterator::parents_stack parents;
     uint16_t node_offset = extra_header()->root.value();
     while (true) {
       parent_node parent{dir_tree_node_ref<LeafValueType>::load(block().get(), node_offset)};
@@ -46,7 +46,7 @@ class DirectoryTree : public SubBlockAllocator<DirectoryTreeHeader> {
   iterator end() const {
     if (size() == 0)
       return {block().get(), {}, {}};
-    std::vector<typename iterator::parent_node_info> parents;
+    typename iterator::parents_stack parents;
     uint16_t node_offset = extra_header()->root.value();
     while (true) {
       parents.emplace_back(dir_tree_node_ref<LeafValueType>::load(block().get(), node_offset));
@@ -240,7 +240,7 @@ class DirectoryTree : public SubBlockAllocator<DirectoryTreeHeader> {
   iterator find(std::string_view key, bool exact_match = true) const {
     if (size() == 0)
       return end();
-    std::vector<typename iterator::parent_node_info> parents;
+    typename iterator::parents_stack parents;
     uint16_t node_offset = extra_header()->root.value();
     auto current_key = key.begin();
     while (true) {
@@ -421,7 +421,7 @@ class DirectoryTree : public SubBlockAllocator<DirectoryTreeHeader> {
   void split_copy(DirectoryTree& new_tree,
                   std::optional<typename iterator::parent_node_info> parent,
                   const parent_node& node,
-                  const std::vector<typename iterator::parent_node_info>& split_parents,
+                  const typename iterator::parents_stack& split_parents,
                   bool left,
                   size_t depth = 0,
                   std::optional<typename iterator::parent_node_info> new_parent = std::nullopt) const {
@@ -11,6 +11,7 @@
 #include <ranges>
 
 #include "directory_tree_node.h"
+#include "small_vector.h"
 
 template <typename LeafValueType>
 struct DiretoryTreeItem {
@@ -24,6 +25,9 @@ class DirectoryTreeIterator {
   using parent_node_info = dir_node_iterator_info<DirectoryTreeNode<LeafValueType>>;
   using leaf_node_info = dir_tree_leaf_node_item_ref<LeafValueType>;
 
+  // One level per key character that branches, names rarely branch more than that.
+  using parents_stack = SmallVector<parent_node_info, 8>;
+
   struct item_ref {
     item_ref() = default;
     item_ref(std::string key, leaf_node_info leaf) : key_(std::move(key)), leaf_(leaf) {}
@@ -48,7 +52,7 @@ class DirectoryTreeIterator {
   using reference = ref_type;
 
   DirectoryTreeIterator() = default;
-  DirectoryTreeIterator(Block* block, std::vector<parent_node_info> parents, std::optional<leaf_node_info> leaf)
+  DirectoryTreeIterator(Block* block, parents_stack parents, std::optional<leaf_node_info> leaf)
       : block_(block), parents_(std::move(parents)), leaf_(std::move(leaf)) {}
   DirectoryTreeIterator(const DirectoryTreeIterator& other) = default;
 
@@ -71,7 +75,7 @@ class DirectoryTreeIterator {
     leaf_.reset();
 
     if (parents_.back().iterator.is_end()) {
-      std::vector<parent_node_info> removed_parents;
+      parents_stack removed_parents;
       do {
         removed_parents.push_back(std::move(parents_.back()));
         parents_.pop_back();
@@ -144,8 +148,8 @@ class DirectoryTreeIterator {
     return leaf_->get_node() == other.leaf_->get_node();
   }
 
-  std::vector<parent_node_info>& parents() { return parents_; };
-  const std::vector<parent_node_info>& parents() const { return parents_; };
+  parents_stack& parents() { return parents_; };
+  const parents_stack& parents() const { return parents_; };
   leaf_node_info& leaf() { return *leaf_; }
   const leaf_node_info& leaf() const { return *leaf_; }
 
@@ -166,6 +170,6 @@ class DirectoryTreeIterator {
   };
 
   Block* block_;
-  std::vector<parent_node_info> parents_;
+  parents_stack parents_;
   std::optional<leaf_node_info> leaf_;
 };
@@ -32,7 +32,7 @@ bool EPTree::insert(const iterator::value_type& key_value) {
     RTree new_left{node_level.block()};
     if (depth == tree_header()->depth.value()) {
       // This is the root split it to two new trees
-      if (depth == 3) {
+      if (depth == iterator::kMaxDepth) {
         // can't grow anymore
         return false;
       }
@@ -105,8 +105,7 @@ uint32_t EPTree::AllocBlockForTree(uint32_t near, std::vector<FreeBlocksExtentIn
 }
 
 EPTree::iterator EPTree::begin() const {
-  std::vector<iterator::node_info> nodes;
-  nodes.reserve(tree_header()->depth.value());
+  iterator::nodes_stack nodes;
   assert(tree_header()->depth.value() >= 1);
   for (int i = 0; i < tree_header()->depth.value(); i++) {
     assert(i == 0 || !nodes.back().iterator.is_end());
@@ -118,8 +117,7 @@ EPTree::iterator EPTree::begin() const {
 }
 
 EPTree::iterator EPTree::end() const {
-  std::vector<iterator::node_info> nodes;
-  nodes.reserve(tree_header()->depth.value());
+  iterator::nodes_stack nodes;
   assert(tree_header()->depth.value() >= 1);
   for (int i = 0; i < tree_header()->depth.value(); i++) {
     assert(i == 0 || !nodes.back().iterator.is_begin());
@@ -131,8 +129,7 @@ EPTree::iterator EPTree::end() const {
 }
 
 EPTree::iterator EPTree::find(key_type key, bool exact_match) const {
-  std::vector<iterator::node_info> nodes;
-  nodes.reserve(tree_header()->depth.value());
+  iterator::nodes_stack nodes;
   for (int i = 0; i < tree_header()->depth.value(); i++) {
     assert(i == 0 || !nodes.back().iterator.is_end());
     iterator::node_info node{i == 0 ? block() : allocator_->LoadAllocatorBlock((*nodes.back().iterator).value())};
@@ -8,9 +8,9 @@
 #pragma once
 
 #include <iterator>
-#include <vector>
 
 #include "rtree.h"
+#include "small_vector.h"
 
 class FreeBlocksAllocator;
 
@@ -24,9 +24,13 @@ class EPTreeIterator {
 
   using node_info = node_iterator_info<RTree>;
 
+  // The EPTree is at most 3 levels deep.
+  static constexpr uint8_t kMaxDepth = 3;
+  using nodes_stack = SmallVector<node_info, kMaxDepth>;
+
   EPTreeIterator() = default;
 
-  EPTreeIterator(FreeBlocksAllocator* allocator, std::vector<node_info> nodes)
+  EPTreeIterator(FreeBlocksAllocator* allocator, nodes_stack nodes)
       : allocator_(allocator), nodes_(std::move(nodes)) {}
 
   reference operator*() const { return *nodes_.back().iterator; }
@@ -38,8 +42,8 @@ class EPTreeIterator {
 
   bool operator==(const EPTreeIterator& other) const { return nodes_.back().iterator == other.nodes_.back().iterator; }
 
-  std::vector<node_info>& nodes() { return nodes_; };
-  const std::vector<node_info>& nodes() const { return nodes_; };
+  nodes_stack& nodes() { return nodes_; };
+  const nodes_stack& nodes() const { return nodes_; };
 
   bool is_begin() const {
     return std::ranges::all_of(nodes_, [](const node_info& node) { return node.iterator.is_begin(); });
@@ -49,6 +53,6 @@ class EPTreeIterator {
  private:
   FreeBlocksAllocator* allocator_;
 
-  std::vector<node_info> nodes_;
+  nodes_stack nodes_;
 };
 static_assert(std::bidirectional_iterator<EPTreeIterator>);
@@ -11,6 +11,7 @@
 #include <limits>
 
 #include "block.h"
+#include "blocks_device.h"
 #include "file_layout_accessor.h"
 #include "file_resizer.h"
 
@@ -30,7 +31,8 @@ void File::Resize(size_t new_size) {
   FileResizer(shared_from_this()).Resize(new_size);
 }
 
-File::file_device::file_device(const std::shared_ptr<File>& file) : file_(file), pos_(0) {}
+File::file_device::file_device(const std::shared_ptr<File>& file, bool range_reads)
+    : file_(file), pos_(0), range_reads_(range_reads) {}
 
 size_t File::file_device::size() const {
   return file_->metadata()->file_size.value();
@@ -49,9 +51,25 @@ std::streamsize File::file_device::read(char_type* s, std::streamsize n) {
 
   auto layout = CreateLayoutAccessor(file_);
   std::streamsize to_read = result;
+  boost::iostreams::stream_offset prefetched_end = pos_;
   while (to_read > 0) {
-    size_t read =
-        layout->Read(reinterpret_cast<std::byte*>(s), static_cast<size_t>(pos_), static_cast<size_t>(to_read));
+    // Range reads don't load whole blocks, not even ahead of time. The blocks are prefetched a window at a time, so
+    // a long read doesn't hold all of them in memory.
+    if (!range_reads_ && pos_ >= prefetched_end) {
+      auto const window = std::min(to_read, static_cast<std::streamsize>(BlocksDevice::kMaxPrefetchBytes));
+      layout->Prefetch(static_cast<size_t>(pos_), static_cast<size_t>(window));
+      prefetched_end = pos_ + window;
+    }
+    size_t read;
+    if (range_reads_) {
+      auto range_read =
+          layout->ReadRange(reinterpret_cast<std::byte*>(s), static_cast<size_t>(pos_), static_cast<size_t>(to_read));
+      if (range_read.unverified_block_offset)
+        unverified_blocks_.insert(*range_read.unverified_block_offset);
+      read = range_read.size;
+    } else {
+      read = layout->Read(reinterpret_cast<std::byte*>(s), static_cast<size_t>(pos_), static_cast<size_t>(to_read));
+    }
     s += read;
     pos_ += read;
     to_read -= read;
@@ -117,7 +135,20 @@ boost::iostreams::stream_offset File::file_device::seek(boost::iostreams::stream
 }
 
 std::streamsize File::file_device::optimal_buffer_size() const {
+  // Buffering whole blocks would defeat the range reads.
+  if (range_reads_)
+    return std::streamsize{1} << log2_size(BlockSize::Physical);
   // Max block size. TODO: By category
   // TODO: The pback_buffer_size, which is actually used, is 0x10004, fix it
   return std::streamsize{1} << (log2_size(BlockSize::Logical) + log2_size(BlockType::Cluster));
 }
+
+void File::file_device::VerifyRangeReads() {
+  auto layout = CreateLayoutAccessor(file_);
+  for (auto block_offset : unverified_blocks_) {
+    // Loading the block checks its hash. The blocks that were truncated since don't matter anymore.
+    if (block_offset < size())
+      layout->GetData(block_offset, 1);
+  }
+  unverified_blocks_.clear();
+}
@@ -7,27 +7,106 @@
 
 #include "file_device.h"
 
+#include <algorithm>
 #include <cassert>
 #include <filesystem>
 #include <fstream>
+#include <vector>
+
+#include "aligned_allocator.h"
+#include "native_file.h"
+
+namespace {
+// Ranges that follow each other on the device.
+struct SectorsRun {
+  uint32_t sector_address;
+  std::vector<std::span<std::byte>> buffers;
+};
+
+std::vector<SectorsRun> ContiguousRuns(std::span<const Device::SectorsRange> ranges, uint32_t log2_sector_size) {
+  std::vector<const Device::SectorsRange*> sorted;
+  sorted.reserve(ranges.size());
+  for (const auto& range : ranges) {
+    if (!range.data.empty())
+      sorted.push_back(&range);
+  }
+  // Stable, so a later write to the same sectors still wins.
+  std::ranges::stable_sort(sorted, {}, &Device::SectorsRange::sector_address);
+  std::vector<SectorsRun> runs;
+  uint64_t run_end = 0;
+  for (const auto* range : sorted) {
+    if (runs.empty() || range->sector_address != run_end)
+      runs.push_back({range->sector_address, {}});
+    runs.back().buffers.push_back(range->data);
+    run_end = range->sector_address + (range->data.size() >> log2_sector_size);
+  }
+  return runs;
+}
+
+bool IsAligned(std::span<const std::span<std::byte>> buffers) {
+  return std::ranges::all_of(buffers, [](const auto& buffer) { return IsDirectIoAligned(buffer.data()); });
+}
+
+size_t TotalSize(std::span<const std::span<std::byte>> buffers) {
+  size_t size = 0;
+  for (const auto& buffer : buffers)
+    size += buffer.size();
+  return size;
+}
+
+// Direct I/O can only use aligned buffers, so misaligned ones are transferred through an aligned copy.
+bool ReadBuffers(const NativeFile& file, std::span<const std::span<std::byte>> buffers, uint64_t offset, bool direct) {
+  if (!direct || IsAligned(buffers))
+    return file.ReadAtV(buffers, offset);
+  AlignedBuffer bounce(TotalSize(buffers));
+  if (!file.ReadAt(bounce, offset))
+    return false;
+  auto data = bounce.begin();
+  for (const auto& buffer : buffers) {
+    std::copy(data, data + buffer.size(), buffer.begin());
+    data += buffer.size();
+  }
+  return true;
+}
+
+bool WriteBuffers(const NativeFile& file, std::span<const std::span<std::byte>> buffers, uint64_t offset, bool direct) {
+  if (!direct || IsAligned(buffers)) {
+    std::vector<std::span<const std::byte>> const_buffers(buffers.begin(), buffers.end());
+    return file.WriteAtV(const_buffers, offset);
+  }
+  AlignedBuffer bounce;
+  bounce.reserve(TotalSize(buffers));
+  for (const auto& buffer : buffers)
+    bounce.insert(bounce.end(), buffer.begin(), buffer.end());
+  return file.WriteAt(bounce, offset);
+}
+}  // namespace
 
 FileDevice::FileDevice(const std::filesystem::path& path,
                        uint32_t log2_sector_size,
                        uint32_t sectors_count,
                        bool read_only,
-                       bool open_create)
-    : log2_sector_size_(log2_sector_size), sectors_count_(sectors_count), read_only_(read_only) {
-  std::ios_base::openmode mode = std::ios::binary | std::ios::in;
-  if (!read_only)
-    mode |= std::ios::out;
-  file_.reset(new std::fstream(path, mode));
-  if (file_->fail() && open_create) {
-    // try to create the file
-    mode |= std::ios::trunc;
+                       bool open_create,
+                       IoMode io_mode)
+    : io_mode_(io_mode), log2_sector_size_(log2_sector_size), sectors_count_(sectors_count), read_only_(read_only) {
+  if (io_mode_ != IoMode::Stream) {
+    native_file_ = NativeFile::Open(path, read_only, open_create, /*direct=*/io_mode_ == IoMode::Direct);
+    if (!native_file_) {
+      throw std::runtime_error("FileDevice: Failed to open file");
+    }
+  } else {
+    std::ios_base::openmode mode = std::ios::binary | std::ios::in;
+    if (!read_only)
+      mode |= std::ios::out;
     file_.reset(new std::fstream(path, mode));
-  }
-  if (file_->fail()) {
-    throw std::runtime_error("FileDevice: Failed to open file");
+    if (file_->fail() && open_create) {
+      // try to create the file
+      mode |= std::ios::trunc;
+      file_.reset(new std::fstream(path, mode));
+    }
+    if (file_->fail()) {
+      throw std::runtime_error("FileDevice: Failed to open file");
+    }
   }
   if (log2_sector_size < 9) {
     throw std::runtime_error("FileDevice: Invalid sector size (<512)");
@@ -37,11 +116,19 @@ FileDevice::FileDevice(const std::filesystem::path& path,
                             // Wfs::DetectSectorsCount
 }
 
+FileDevice::~FileDevice() = default;
+
 void FileDevice::ReadSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) {
   assert(data.size() == (sectors_count << log2_sector_size_));
   if (sector_address >= sectors_count_ || sector_address + sectors_count > sectors_count_) {
     throw std::runtime_error("FileDevice: Read out of file.");
   }
+  if (native_file_) {
+    if (!ReadBuffers(*native_file_, {&data, 1}, static_cast<uint64_t>(sector_address) << log2_sector_size_,
+                     io_mode_ == IoMode::Direct))
+      throw std::runtime_error("FileDevice: Failed to read from file.");
+    return;
+  }
   std::lock_guard<std::mutex> guard(io_lock_);
   file_->seekg(static_cast<std::streampos>(sector_address) << log2_sector_size_);
   file_->read(reinterpret_cast<char*>(data.data()), data.size());
@@ -59,6 +146,12 @@ void FileDevice::WriteSectors(const std::span<std::byte>& data, uint32_t sector_
   if (data.size() < sectors_count << log2_sector_size_) {
     throw std::runtime_error("FileDevice: Not enough data for writing.");
   }
+  if (native_file_) {
+    if (!WriteBuffers(*native_file_, {&data, 1}, static_cast<uint64_t>(sector_address) << log2_sector_size_,
+                      io_mode_ == IoMode::Direct))
+      throw std::runtime_error("FileDevice: Failed to write to file.");
+    return;
+  }
   std::lock_guard<std::mutex> guard(io_lock_);
   file_->seekp(static_cast<std::streampos>(sector_address) << log2_sector_size_);
   file_->write(reinterpret_cast<const char*>(data.data()), data.size());
@@ -66,7 +159,72 @@ void FileDevice::WriteSectors(const std::span<std::byte>& data, uint32_t sector_
     throw std::runtime_error("FileDevice: Failed to write to file.");
 }
 
+void FileDevice::ReadSectorsBatch(std::span<const SectorsRange> ranges) {
+  CheckBatchBounds(ranges, "FileDevice: Read out of file.");
+  auto runs = ContiguousRuns(ranges, log2_sector_size_);
+  if (native_file_) {
+    for (const auto& run : runs) {
+      if (!ReadBuffers(*native_file_, run.buffers, static_cast<uint64_t>(run.sector_address) << log2_sector_size_,
+                       io_mode_ == IoMode::Direct))
+        throw std::runtime_error("FileDevice: Failed to read from file.");
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> guard(io_lock_);
+  for (const auto& run : runs) {
+    file_->seekg(static_cast<std::streampos>(run.sector_address) << log2_sector_size_);
+    for (const auto& buffer : run.buffers) {
+      file_->read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+      if (file_->gcount() != static_cast<std::streamsize>(buffer.size()))
+        throw std::runtime_error("FileDevice: Failed to read from file.");
+    }
+  }
+}
+
+void FileDevice::WriteSectorsBatch(std::span<const SectorsRange> ranges) {
+  if (read_only_) {
+    throw std::runtime_error("FileDevice: Can't write - read only mode");
+  }
+  CheckBatchBounds(ranges, "FileDevice: Write out of file.");
+  auto runs = ContiguousRuns(ranges, log2_sector_size_);
+  if (native_file_) {
+    for (const auto& run : runs) {
+      if (!WriteBuffers(*native_file_, run.buffers, static_cast<uint64_t>(run.sector_address) << log2_sector_size_,
+                        io_mode_ == IoMode::Direct))
+        throw std::runtime_error("FileDevice: Failed to write to file.");
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> guard(io_lock_);
+  for (const auto& run : runs) {
+    file_->seekp(static_cast<std::streampos>(run.sector_address) << log2_sector_size_);
+    for (const auto& buffer : run.buffers)
+      file_->write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    if (file_->fail())
+      throw std::runtime_error("FileDevice: Failed to write to file.");
+  }
+}
+
+std::vector<Device::SectorsExtent> FileDevice::DataExtents(uint32_t sector_address, uint32_t sectors_count) const {
+  // No native handle to ask in stream mode.
+  if (!native_file_)
+    return Device::DataExtents(sector_address, sectors_count);
+  return native_file_->DataSectors(sector_address, sectors_count, log2_sector_size_);
+}
+
 uint64_t FileDevice::GetFileSize() {
+  if (native_file_)
+    return native_file_->Size();
   file_->seekg(0, std::ios::end);
   return file_->tellg();
 }
+
+void FileDevice::CheckBatchBounds(std::span<const SectorsRange> ranges, const char* error) const {
+  for (const auto& range : ranges) {
+    assert(range.data.size() % (size_t{1} << log2_sector_size_) == 0);
+    auto const sectors_count = static_cast<uint32_t>(range.data.size() >> log2_sector_size_);
+    if (range.sector_address >= sectors_count_ || range.sector_address + sectors_count > sectors_count_) {
+      throw std::runtime_error(error);
+    }
+  }
+}
@@ -53,7 +53,7 @@ class File::BlockListLayoutAccessor : public File::LayoutAccessor {
 
   std::span<std::byte> GetMutableData(size_t offset, size_t size) override {
     auto data_ref = GetDataRef(offset, size);
-    return data_ref.data_block->mutable_data().subspan(data_ref.offset_in_block, data_ref.size);
+    return data_ref.data_block->mutable_data(data_ref.offset_in_block, data_ref.size);
   }
 
   DataRef GetDataRef(size_t offset, size_t size) override {
@@ -79,15 +79,47 @@ class File::BlockListLayoutAccessor : public File::LayoutAccessor {
     return {current_data_block, offset_in_block, size};
   }
 
-  virtual DataRef GetDataRef(size_t offset, size_t size, size_t file_size) {
+  DataRef GetDataRef(size_t offset, size_t size, size_t file_size) {
+    auto block_ref = GetDataBlockRef(offset, file_size);
+    auto offset_in_block = offset - block_ref.offset;
+    return GetDataFromBlock(std::move(block_ref), offset_in_block, size);
+  }
+
+  virtual DataBlockRef GetDataBlockRef(size_t offset, size_t file_size) {
     auto block_position = BlockPositionForOffset(offset, GetDataBlockSize());
     auto location =
         FileDataBlockLocationFor(CurrentCategory(file_->metadata()), file_->metadata_block(), file_->metadata(),
                                  block_position.index, file_->quota()->block_size_log2());
-    auto block_ref =
-        DataBlockRef{location.block_number, location.block_type, block_position.offset,
-                     DataSizeForBlock(file_size, block_position.offset, GetDataBlockSize()), std::move(location.hash)};
-    return GetDataFromBlock(std::move(block_ref), block_position.offset_in_block, size);
+    return {location.block_number, location.block_type, block_position.offset,
+            DataSizeForBlock(file_size, block_position.offset, GetDataBlockSize()), std::move(location.hash)};
+  }
+
+  RangeRead ReadRange(std::byte* output, size_t offset, size_t size) override {
+    // Reads of more than this part of a block load all of it, so the following reads can use it.
+    constexpr size_t kMaxRangeReadFraction = 4;
+    auto block_ref = GetDataBlockRef(offset, file_->metadata()->file_size.value());
+    auto offset_in_block = offset - block_ref.offset;
+    size = std::min(size, block_ref.size - offset_in_block);
+    if (size > block_ref.size / kMaxRangeReadFraction)
+      return {Read(output, offset, size), std::nullopt};
+    bool verified = throw_if_error(file_->quota()->ReadDataBlockRange(
+        block_ref.block_number, static_cast<uint32_t>(block_ref.size), file_->IsEncrypted(), offset_in_block,
+        {output, size}));
+    return {size, verified ? std::nullopt : std::optional{block_ref.offset}};
+  }
+
+  void Prefetch(size_t offset, size_t size) override {
+    const size_t file_size = file_->metadata()->file_size.value();
+    const auto end = std::min(offset + size, file_size);
+    std::vector<BlocksDevice::BlockExtent> blocks;
+    for (auto block_offset = floor_pow2(offset, GetDataBlockSize()); block_offset < end;
+         block_offset += size_t{1} << GetDataBlockSize()) {
+      auto block_ref = GetDataBlockRef(block_offset, file_size);
+      blocks.push_back({block_ref.block_number, static_cast<uint32_t>(block_ref.size)});
+    }
+    // Blocks that are already loaded are skipped by the device, and a single block gains nothing from a batch.
+    if (blocks.size() > 1)
+      file_->quota()->PrefetchDataBlocks(blocks);
   }
 
   void Resize(size_t new_size) override {
@@ -200,9 +232,9 @@ class File::ClustersLayoutAccessor : public File::LargeBlocksLayoutAccessor {
 
   size_t GetMetadataSize() const override { return GetMetadataItemsCount() * sizeof(DataBlocksClusterMetadata); }
 
-  DataRef GetDataRef(size_t offset, size_t size, size_t file_size) override {
-    return GetDataRefFromClustersList(/*cluster_list_start=*/0, offset, size, file_size, file_->metadata_block(),
-                                      ClusterRefs());
+  DataBlockRef GetDataBlockRef(size_t offset, size_t file_size) override {
+    return GetDataBlockRefFromClustersList(/*cluster_list_start=*/0, offset, file_size, file_->metadata_block(),
+                                           ClusterRefs());
   }
 
   std::vector<DataBlockRef> EnumerateBlocks() const override {
@@ -212,20 +244,18 @@ class File::ClustersLayoutAccessor : public File::LargeBlocksLayoutAccessor {
 
  protected:
   template <typename ClusterArray>
-  DataRef GetDataRefFromClustersList(size_t cluster_list_start,
-                                     size_t offset,
-                                     size_t size,
-                                     size_t file_size,
-                                     const std::shared_ptr<Block>& metadata_block,
-                                     ClusterArray&& clusters_list) {
+  DataBlockRef GetDataBlockRefFromClustersList(size_t cluster_list_start,
+                                               size_t offset,
+                                               size_t file_size,
+                                               const std::shared_ptr<Block>& metadata_block,
+                                               ClusterArray&& clusters_list) {
     auto offset_in_cluster_list = offset - (cluster_list_start << ClusterDataLog2Size());
     auto block_position = BlockPositionForOffset(offset_in_cluster_list, GetDataBlockSize());
     auto block_offset = floor_pow2(offset, GetDataBlockSize());
     auto location = FileDataBlockLocationForLogicalMetadata<FileLayoutCategory::Clusters>(metadata_block, clusters_list,
                                                                                           block_position.index);
-    return GetDataFromBlock({location.block_number, location.block_type, block_offset,
-                             DataSizeForBlock(file_size, block_offset, GetDataBlockSize()), std::move(location.hash)},
-                            block_position.offset_in_block, size);
+    return {location.block_number, location.block_type, block_offset,
+            DataSizeForBlock(file_size, block_offset, GetDataBlockSize()), std::move(location.hash)};
   }
 
   template <typename ClusterArray>
@@ -262,7 +292,7 @@ class File::ClusterMetadataBlocksLayoutAccessor : public File::ClustersLayoutAcc
 
   size_t GetMetadataSize() const override { return GetMetadataItemsCount() * sizeof(uint32_be_t); }
 
-  DataRef GetDataRef(size_t offset, size_t size, size_t file_size) override {
+  DataBlockRef GetDataBlockRef(size_t offset, size_t file_size) override {
     auto block_position = BlockPositionForOffset(offset, GetDataBlockSize());
     auto blocks_list = ::ClusterMetadataBlockRefs(file_->metadata(), GetMetadataItemsCount());
     const auto metadata_block_index =
@@ -273,10 +303,8 @@ class File::ClusterMetadataBlocksLayoutAccessor : public File::ClustersLayoutAcc
         current_metadata_block,
         ClusterMetadataBlockDataBlockIndex(block_position.index, file_->quota()->block_size_log2()),
         file_->quota()->block_size_log2());
-    return GetDataFromBlock(
-        {location.block_number, location.block_type, block_position.offset,
-         DataSizeForBlock(file_size, block_position.offset, GetDataBlockSize()), std::move(location.hash)},
-        block_position.offset_in_block, size);
+    return {location.block_number, location.block_type, block_position.offset,
+            DataSizeForBlock(file_size, block_position.offset, GetDataBlockSize()), std::move(location.hash)};
   }
 
   std::vector<DataBlockRef> EnumerateBlocks() const override {
@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <memory>
+#include <optional>
 #include <ranges>
 #include <span>
 #include <stdexcept>
@@ -51,6 +52,12 @@ class File::LayoutAccessor {
     size_t offset_in_block;
   };
 
+  struct RangeRead {
+    size_t size;
+    // Offset in the file of the data block that the data was read from without checking its hash, if any.
+    std::optional<size_t> unverified_block_offset;
+  };
+
   struct DataBlockRef {
     uint32_t block_number;
     BlockType block_type;
@@ -79,6 +86,12 @@ class File::LayoutAccessor {
 
   virtual std::vector<DataBlockRef> EnumerateBlocks() const { return {}; }
 
+  // Hint that [offset, offset + size) is about to be read, so the blocks that store it can be read in one batch.
+  virtual void Prefetch(size_t offset, size_t size) {
+    (void)offset;
+    (void)size;
+  }
+
   void CopyTo(LayoutAccessor& destination, size_t bytes) {
     std::vector<std::byte> buffer(std::min(bytes, size_t{1} << file_->quota()->block_size_log2()));
     size_t offset = 0;
@@ -109,6 +122,12 @@ class File::LayoutAccessor {
     return data.size();
   }
 
+  // Same as Read, but a small read from a data block that isn't loaded reads only the sectors that it needs, see
+  // Area::ReadDataBlockRange.
+  virtual RangeRead ReadRange(std::byte* output, size_t offset, size_t size) {
+    return {Read(output, offset, size), std::nullopt};
+  }
+
   size_t Write(const std::byte* input, size_t offset, size_t size) {
     auto data = GetMutableData(offset, size);
     std::copy(input, input + data.size(), data.begin());
@@ -67,11 +67,11 @@ std::vector<std::shared_ptr<Block>> LoadClusterMetadataBlocks(const std::shared_
   const auto metadata_blocks_count =
       FileLayout::MetadataItemsCount(layout.category, layout.size_on_disk, block_size_log2);
   auto block_refs = ClusterMetadataBlockRefs(metadata, metadata_blocks_count);
-  std::vector<std::shared_ptr<Block>> blocks;
-  blocks.reserve(metadata_blocks_count);
+  std::vector<uint32_t> block_numbers;
+  block_numbers.reserve(metadata_blocks_count);
   for (const auto& block_ref : block_refs)
-    blocks.push_back(throw_if_error(quota->LoadMetadataBlock(block_ref.value())));
-  return blocks;
+    block_numbers.push_back(block_ref.value());
+  return throw_if_error(quota->LoadMetadataBlocks(block_numbers));
 }
 
 template <FileLayoutCategory Category>
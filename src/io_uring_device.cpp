@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "io_uring_device.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+#include "native_file.h"
+
+// Minimal io_uring wrapper over the raw syscalls, with one submission queue and one completion queue.
+class IoUringDevice::Ring {
+ public:
+  Ring(uint32_t entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0)
+      throw std::runtime_error("IoUringDevice: io_uring is not available");
+    if (!SupportsReadWrite()) {
+      close(fd_);
+      throw std::runtime_error("IoUringDevice: io_uring is not available");
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+      close(fd_);
+      throw std::runtime_error("IoUringDevice: Failed to map io_uring");
+    }
+    cq_ring_ = single_mmap ? sq_ring_
+                           : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                                  IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    auto* sqes = cq_ring_ == MAP_FAILED ? MAP_FAILED
+                                        : mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                               fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+        munmap(cq_ring_, cq_ring_size_);
+      munmap(sq_ring_, sq_ring_size_);
+      close(fd_);
+      throw std::runtime_error("IoUringDevice: Failed to map io_uring");
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto* sq = static_cast<std::byte*>(sq_ring_);
+    sq_head_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    sq_entries_ = params.sq_entries;
+
+    auto* cq = static_cast<std::byte*>(cq_ring_);
+    cq_head_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  }
+
+  ~Ring() {
+    munmap(sqes_, sqes_size_);
+    if (cq_ring_ != sq_ring_)
+      munmap(cq_ring_, cq_ring_size_);
+    munmap(sq_ring_, sq_ring_size_);
+    close(fd_);
+  }
+
+  uint32_t sq_entries() const { return sq_entries_; }
+
+  void Queue(uint8_t opcode, int fd, std::byte* data, uint32_t size, uint64_t offset, uint64_t user_data) {
+    auto index = sqe_tail_ & sq_mask_;
+    auto* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    sq_array_[index] = index;
+    ++sqe_tail_;
+    std::atomic_ref(*sq_tail_).store(sqe_tail_, std::memory_order_release);
+  }
+
+  // Submits all the queued entries without waiting. If the kernel fails, the entries are taken out of the queue and
+  // their count is returned.
+  uint32_t Submit() {
+    while (true) {
+      auto const head = std::atomic_ref(*sq_head_).load(std::memory_order_acquire);
+      if (sqe_tail_ == head)
+        return 0;
+      auto res = syscall(__NR_io_uring_enter, fd_, sqe_tail_ - head, 0, 0, nullptr, 0);
+      if (res >= 0)
+        return 0;
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        // The kernel only reads the tail while submitting, so it is safe to move it back.
+        auto const dropped = sqe_tail_ - head;
+        sqe_tail_ = head;
+        std::atomic_ref(*sq_tail_).store(sqe_tail_, std::memory_order_release);
+        return dropped;
+      }
+    }
+  }
+
+  // Waits for at least one completion. Can be called without the ring lock, while other threads queue entries.
+  bool Wait() {
+    while (syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        return false;
+    }
+    return true;
+  }
+
+  bool PopCompletion(io_uring_cqe& cqe) {
+    auto head = std::atomic_ref(*cq_head_).load(std::memory_order_relaxed);
+    if (head == std::atomic_ref(*cq_tail_).load(std::memory_order_acquire))
+      return false;
+    cqe = cqes_[head & cq_mask_];
+    std::atomic_ref(*cq_head_).store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  // IORING_OP_READ and IORING_OP_WRITE need Linux 5.6, like the probe itself, older kernels set up the ring anyway.
+  bool SupportsReadWrite() const {
+    constexpr uint32_t kOpsCount = 256;
+    // Zeroed, as the kernel requires.
+    std::vector<std::byte> buffer(sizeof(io_uring_probe) + kOpsCount * sizeof(io_uring_probe_op));
+    auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, kOpsCount) < 0)
+      return false;
+    auto supported = [probe](uint8_t opcode) {
+      return opcode < probe->ops_len && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    };
+    return supported(IORING_OP_READ) && supported(IORING_OP_WRITE);
+  }
+
+  int fd_;
+
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  uint32_t* sq_head_;
+  uint32_t* sq_tail_;
+  uint32_t sq_mask_;
+  uint32_t* sq_array_;
+  uint32_t sq_entries_;
+  uint32_t sqe_tail_{0};
+
+  uint32_t* cq_head_;
+  uint32_t* cq_tail_;
+  uint32_t cq_mask_;
+  io_uring_cqe* cqes_;
+};
+
+IoUringDevice::IoUringDevice(const std::filesystem::path& path,
+                             uint32_t log2_sector_size,
+                             uint32_t sectors_count,
+                             bool read_only,
+                             bool open_create,
+                             uint32_t queue_depth)
+    : file_(NativeFile::Open(path, read_only, open_create)),
+      log2_sector_size_(log2_sector_size),
+      sectors_count_(sectors_count),
+      read_only_(read_only) {
+  if (!file_) {
+    throw std::runtime_error("IoUringDevice: Failed to open file");
+  }
+  if (log2_sector_size < 9) {
+    throw std::runtime_error("IoUringDevice: Invalid sector size (<512)");
+  }
+  ring_ = std::make_unique<Ring>(queue_depth);
+  if (sectors_count_ == 0)
+    sectors_count_ = 0x10;  // we will find the exact sectors count later with
+                            // Wfs::DetectSectorsCount
+}
+
+IoUringDevice::~IoUringDevice() = default;
+
+void IoUringDevice::ReadSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) {
+  assert(data.size() == (sectors_count << log2_sector_size_));
+  SectorsRange range{data, sector_address};
+  ReadSectorsBatch({&range, 1});
+}
+
+void IoUringDevice::WriteSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) {
+  assert(data.size() == (sectors_count << log2_sector_size_));
+  SectorsRange range{data, sector_address};
+  WriteSectorsBatch({&range, 1});
+}
+
+void IoUringDevice::ReadSectorsBatch(std::span<const SectorsRange> ranges) {
+  for (const auto& range : ranges) {
+    auto const sectors_count = static_cast<uint32_t>(range.data.size() >> log2_sector_size_);
+    if (range.sector_address >= sectors_count_ || range.sector_address + sectors_count > sectors_count_) {
+      throw std::runtime_error("IoUringDevice: Read out of file.");
+    }
+  }
+  Submit(ranges, /*write=*/false);
+}
+
+void IoUringDevice::WriteSectorsBatch(std::span<const SectorsRange> ranges) {
+  if (read_only_) {
+    throw std::runtime_error("IoUringDevice: Can't write - read only mode");
+  }
+  for (const auto& range : ranges) {
+    auto const sectors_count = static_cast<uint32_t>(range.data.size() >> log2_sector_size_);
+    if (range.sector_address >= sectors_count_ || range.sector_address + sectors_count > sectors_count_) {
+      throw std::runtime_error("IoUringDevice: Write out of file.");
+    }
+  }
+  Submit(ranges, /*write=*/true);
+}
+
+std::vector<Device::SectorsExtent> IoUringDevice::DataExtents(uint32_t sector_address, uint32_t sectors_count) const {
+  return file_->DataSectors(sector_address, sectors_count, log2_sector_size_);
+}
+
+uint64_t IoUringDevice::GetFileSize() {
+  return file_->Size();
+}
+
+// Requests of a single batch. Their completions may be reaped by any thread that uses the ring, so they are routed to
+// the batch by their user data, which points to the request.
+struct IoUringDevice::Batch {
+  struct Request {
+    Batch* batch;
+    std::byte* data;
+    size_t remaining;
+    uint64_t offset;
+  };
+
+  std::vector<Request> requests;
+  // Requests that aren't in flight yet, or that have to be queued again.
+  std::deque<Request*> pending;
+  size_t in_flight{0};
+  bool failed{false};
+};
+
+void IoUringDevice::Submit(std::span<const SectorsRange> ranges, bool write) {
+  Batch batch;
+  batch.requests.reserve(ranges.size());
+  for (const auto& range : ranges) {
+    if (range.data.empty())
+      continue;
+    auto const offset = static_cast<uint64_t>(range.sector_address) << log2_sector_size_;
+    batch.requests.push_back({&batch, range.data.data(), range.data.size(), offset});
+  }
+  for (auto& request : batch.requests)
+    batch.pending.push_back(&request);
+
+  std::unique_lock<std::mutex> guard(ring_lock_);
+  // Don't leave before the kernel is done with the buffers, even if a request failed.
+  while ((!batch.failed && !batch.pending.empty()) || batch.in_flight > 0) {
+    // Keep the queue full. The ring is shared by all the callers, so there is room for as many entries as it has.
+    bool queued = false;
+    while (!batch.failed && !batch.pending.empty() && in_flight_ < ring_->sq_entries()) {
+      auto* request = batch.pending.front();
+      batch.pending.pop_front();
+      ring_->Queue(write ? IORING_OP_WRITE : IORING_OP_READ, file_->native_handle(), request->data,
+                   static_cast<uint32_t>(std::min<size_t>(request->remaining, 1 << 30)), request->offset,
+                   reinterpret_cast<uint64_t>(request));
+      ++batch.in_flight;
+      ++in_flight_;
+      queued = true;
+    }
+    if (queued) {
+      // Every caller submits right after queuing, so entries that weren't submitted are of this batch.
+      if (auto const dropped = ring_->Submit(); dropped > 0) {
+        batch.in_flight -= dropped;
+        in_flight_ -= dropped;
+        batch.failed = true;
+      }
+    }
+    if (waiting_) {
+      // Another thread waits for the kernel. Only it reaps, otherwise it may wait for completions that were already
+      // taken. It wakes us up when it is done.
+      completions_.wait(guard);
+      continue;
+    }
+    ReapCompletions();
+    if ((batch.failed || batch.pending.empty()) && batch.in_flight == 0)
+      break;
+    // The completions may have made room for more requests.
+    if (!batch.failed && !batch.pending.empty() && in_flight_ < ring_->sq_entries())
+      continue;
+    // Something is in flight, either of this batch or of the ones that took the room in the ring. Wait for the kernel
+    // without the lock, so other threads can queue their requests meanwhile.
+    waiting_ = true;
+    guard.unlock();
+    bool const waited = ring_->Wait();
+    guard.lock();
+    waiting_ = false;
+    if (!waited)
+      batch.failed = true;
+    ReapCompletions();
+    completions_.notify_all();
+  }
+  if (batch.failed || !batch.pending.empty()) {
+    throw std::runtime_error(write ? "IoUringDevice: Failed to write to file."
+                                   : "IoUringDevice: Failed to read from file.");
+  }
+}
+
+void IoUringDevice::ReapCompletions() {
+  io_uring_cqe cqe;
+  bool reaped = false;
+  while (ring_->PopCompletion(cqe)) {
+    reaped = true;
+    --in_flight_;
+    auto* request = reinterpret_cast<Batch::Request*>(cqe.user_data);
+    auto& batch = *request->batch;
+    --batch.in_flight;
+    if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+      batch.pending.push_back(request);
+      continue;
+    }
+    if (cqe.res <= 0) {
+      batch.failed = true;
+      continue;
+    }
+    // Short transfer, queue the rest.
+    auto transferred = static_cast<size_t>(cqe.res);
+    request->data += transferred;
+    request->offset += transferred;
+    request->remaining -= transferred;
+    if (request->remaining > 0)
+      batch.pending.push_back(request);
+  }
+  // The batches of the other threads may be done, or have room in the ring.
+  if (reaped)
+    completions_.notify_all();
+}
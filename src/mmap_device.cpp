@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "mmap_device.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+#include "native_file.h"
+
+MmapDevice::MmapDevice(const std::filesystem::path& path,
+                       uint32_t log2_sector_size,
+                       uint32_t sectors_count,
+                       bool read_only,
+                       bool open_create)
+    : file_(NativeFile::Open(path, read_only, open_create)),
+      log2_sector_size_(log2_sector_size),
+      sectors_count_(sectors_count),
+      read_only_(read_only) {
+  if (!file_) {
+    throw std::runtime_error("MmapDevice: Failed to open file");
+  }
+  if (log2_sector_size < 9) {
+    throw std::runtime_error("MmapDevice: Invalid sector size (<512)");
+  }
+  MapFile();
+  if (sectors_count_ == 0)
+    sectors_count_ = 0x10;  // we will find the exact sectors count later with
+                            // Wfs::DetectSectorsCount
+}
+
+MmapDevice::~MmapDevice() = default;
+
+void MmapDevice::ReadSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) {
+  assert(data.size() == (sectors_count << log2_sector_size_));
+  if (sector_address >= sectors_count_ || sector_address + sectors_count > sectors_count_) {
+    throw std::runtime_error("MmapDevice: Read out of file.");
+  }
+  auto sectors = GetSectors(sector_address, sectors_count);
+  if (sectors.empty())
+    throw std::runtime_error("MmapDevice: Failed to read from file.");
+  std::ranges::copy(sectors, data.begin());
+}
+
+void MmapDevice::WriteSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) {
+  assert(data.size() == (sectors_count << log2_sector_size_));
+  if (read_only_) {
+    throw std::runtime_error("MmapDevice: Can't write - read only mode");
+  }
+  if (sector_address >= sectors_count_ || sector_address + sectors_count > sectors_count_) {
+    throw std::runtime_error("MmapDevice: Write out of file.");
+  }
+  auto sectors = GetSectors(sector_address, sectors_count);
+  if (sectors.empty())
+    throw std::runtime_error("MmapDevice: Failed to write to file.");
+  std::ranges::copy(data, sectors.begin());
+}
+
+std::span<const std::byte> MmapDevice::SectorsView(uint32_t sector_address, uint32_t sectors_count) const {
+  if (sector_address >= sectors_count_ || sector_address + sectors_count > sectors_count_)
+    return {};
+  return GetSectors(sector_address, sectors_count);
+}
+
+uint64_t MmapDevice::GetFileSize() {
+  return file_->Size();
+}
+
+void MmapDevice::SetSectorsCount(uint32_t sectors_count) {
+  sectors_count_ = sectors_count;
+  if (!read_only_ && (static_cast<uint64_t>(sectors_count_) << log2_sector_size_) > mapping_.size())
+    MapFile();
+}
+
+void MmapDevice::MapFile() {
+  mapping_ = {};
+  file_->Unmap();
+  auto mapping_size = file_->Size();
+  if (!read_only_) {
+    auto const device_size = static_cast<uint64_t>(sectors_count_) << log2_sector_size_;
+    if (device_size > mapping_size) {
+      if (!file_->Resize(device_size))
+        throw std::runtime_error("MmapDevice: Failed to extend file");
+      mapping_size = device_size;
+    }
+  }
+  if (mapping_size > 0) {
+    mapping_ = file_->Map(mapping_size, !read_only_);
+    if (mapping_.empty())
+      throw std::runtime_error("MmapDevice: Failed to map file");
+  }
+}
+
+std::span<std::byte> MmapDevice::GetSectors(uint32_t sector_address, uint32_t sectors_count) const {
+  auto const offset = static_cast<uint64_t>(sector_address) << log2_sector_size_;
+  auto const size = static_cast<uint64_t>(sectors_count) << log2_sector_size_;
+  // Beyond the end of a read-only file.
+  if (offset + size > mapping_.size())
+    return {};
+  return mapping_.subspan(static_cast<size_t>(offset), static_cast<size_t>(size));
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "native_file.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "utils.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winioctl.h>
+#include <array>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <vector>
+#endif
+
+#ifdef _WIN32
+
+NativeFile::~NativeFile() {
+  Unmap();
+  CloseHandle(handle_);
+}
+
+// static
+std::unique_ptr<NativeFile> NativeFile::Open(const std::filesystem::path& path,
+                                             bool read_only,
+                                             bool open_create,
+                                             bool direct) {
+  DWORD access = GENERIC_READ | (read_only ? 0 : GENERIC_WRITE);
+  DWORD flags = FILE_ATTRIBUTE_NORMAL | (direct ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : 0);
+  HANDLE handle =
+      CreateFileW(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, flags, nullptr);
+  if (handle == INVALID_HANDLE_VALUE && open_create && !read_only) {
+    // try to create the file
+    handle =
+        CreateFileW(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS, flags, nullptr);
+  }
+  if (handle == INVALID_HANDLE_VALUE)
+    return nullptr;
+  return std::unique_ptr<NativeFile>(new NativeFile(handle));
+}
+
+bool NativeFile::ReadAt(const std::span<std::byte>& data, uint64_t offset) const {
+  size_t done = 0;
+  while (done < data.size()) {
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(offset + done);
+    overlapped.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+    auto chunk = static_cast<DWORD>(std::min<size_t>(data.size() - done, std::numeric_limits<DWORD>::max()));
+    DWORD read = 0;
+    if (!ReadFile(handle_, data.data() + done, chunk, &read, &overlapped) || read == 0)
+      return false;
+    done += read;
+  }
+  return true;
+}
+
+bool NativeFile::WriteAt(const std::span<const std::byte>& data, uint64_t offset) const {
+  size_t done = 0;
+  while (done < data.size()) {
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(offset + done);
+    overlapped.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+    auto chunk = static_cast<DWORD>(std::min<size_t>(data.size() - done, std::numeric_limits<DWORD>::max()));
+    DWORD wrote = 0;
+    if (!WriteFile(handle_, data.data() + done, chunk, &wrote, &overlapped) || wrote == 0)
+      return false;
+    done += wrote;
+  }
+  return true;
+}
+
+bool NativeFile::ReadAtV(std::span<const std::span<std::byte>> buffers, uint64_t offset) const {
+  // ReadFileScatter requires unbuffered page sized buffers, just transfer them one by one.
+  for (const auto& buffer : buffers) {
+    if (!ReadAt(buffer, offset))
+      return false;
+    offset += buffer.size();
+  }
+  return true;
+}
+
+bool NativeFile::WriteAtV(std::span<const std::span<const std::byte>> buffers, uint64_t offset) const {
+  for (const auto& buffer : buffers) {
+    if (!WriteAt(buffer, offset))
+      return false;
+    offset += buffer.size();
+  }
+  return true;
+}
+
+uint64_t NativeFile::Size() const {
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(handle_, &size))
+    return 0;
+  return static_cast<uint64_t>(size.QuadPart);
+}
+
+std::vector<NativeFile::Extent> NativeFile::DataExtents(uint64_t offset, uint64_t size) const {
+  std::vector<Extent> extents;
+  FILE_ALLOCATED_RANGE_BUFFER query;
+  query.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+  query.Length.QuadPart = static_cast<LONGLONG>(size);
+  std::array<FILE_ALLOCATED_RANGE_BUFFER, 64> ranges;
+  while (true) {
+    DWORD bytes = 0;
+    bool more_data = false;
+    if (!DeviceIoControl(handle_, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), ranges.data(),
+                         static_cast<DWORD>(sizeof(ranges)), &bytes, nullptr)) {
+      if (GetLastError() != ERROR_MORE_DATA)
+        return {{offset, size}};
+      more_data = true;
+    }
+    auto const count = bytes / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+    for (size_t i = 0; i < count; ++i) {
+      extents.push_back(
+          {static_cast<uint64_t>(ranges[i].FileOffset.QuadPart), static_cast<uint64_t>(ranges[i].Length.QuadPart)});
+    }
+    if (!more_data || count == 0)
+      break;
+    auto const next = extents.back().offset + extents.back().size;
+    query.FileOffset.QuadPart = static_cast<LONGLONG>(next);
+    query.Length.QuadPart = static_cast<LONGLONG>(offset + size - next);
+  }
+  return extents;
+}
+
+bool NativeFile::Resize(uint64_t size) const {
+  FILE_END_OF_FILE_INFO info;
+  info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+  return SetFileInformationByHandle(handle_, FileEndOfFileInfo, &info, sizeof(info));
+}
+
+std::span<std::byte> NativeFile::Map(uint64_t size, bool writable) {
+  Unmap();
+  if (size == 0)
+    return {};
+  mapping_handle_ = CreateFileMappingW(handle_, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                       static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+  if (!mapping_handle_)
+    return {};
+  auto* view =
+      MapViewOfFile(mapping_handle_, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(size));
+  if (!view) {
+    CloseHandle(mapping_handle_);
+    mapping_handle_ = nullptr;
+    return {};
+  }
+  mapping_ = {static_cast<std::byte*>(view), static_cast<size_t>(size)};
+  return mapping_;
+}
+
+void NativeFile::Unmap() {
+  if (!mapping_.empty())
+    UnmapViewOfFile(mapping_.data());
+  if (mapping_handle_)
+    CloseHandle(mapping_handle_);
+  mapping_ = {};
+  mapping_handle_ = nullptr;
+}
+
+#else
+
+NativeFile::~NativeFile() {
+  Unmap();
+  close(handle_);
+}
+
+// static
+std::unique_ptr<NativeFile> NativeFile::Open(const std::filesystem::path& path,
+                                             bool read_only,
+                                             bool open_create,
+                                             bool direct) {
+  int flags = (read_only ? O_RDONLY : O_RDWR) | O_CLOEXEC;
+#ifdef O_DIRECT
+  if (direct)
+    flags |= O_DIRECT;
+#endif
+  int fd = open(path.c_str(), flags);
+  if (fd < 0 && open_create && !read_only) {
+    // try to create the file
+    fd = open(path.c_str(), flags | O_CREAT | O_TRUNC, 0644);
+  }
+  if (fd < 0)
+    return nullptr;
+#ifdef F_NOCACHE
+  // macOS has no O_DIRECT, caching is turned off on the descriptor instead.
+  if (direct && fcntl(fd, F_NOCACHE, 1) != 0) {
+    close(fd);
+    return nullptr;
+  }
+#endif
+  return std::unique_ptr<NativeFile>(new NativeFile(fd));
+}
+
+bool NativeFile::ReadAt(const std::span<std::byte>& data, uint64_t offset) const {
+  size_t done = 0;
+  while (done < data.size()) {
+    auto res = pread(handle_, data.data() + done, data.size() - done, static_cast<off_t>(offset + done));
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      return false;
+    done += static_cast<size_t>(res);
+  }
+  return true;
+}
+
+bool NativeFile::WriteAt(const std::span<const std::byte>& data, uint64_t offset) const {
+  size_t done = 0;
+  while (done < data.size()) {
+    auto res = pwrite(handle_, data.data() + done, data.size() - done, static_cast<off_t>(offset + done));
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      return false;
+    done += static_cast<size_t>(res);
+  }
+  return true;
+}
+
+namespace {
+// Both Linux and macOS accept at least this many iovecs per call.
+constexpr size_t kMaxIovecs = 1024;
+
+template <typename Buffer, typename Transfer>
+bool TransferVectored(std::span<const Buffer> buffers, uint64_t offset, Transfer&& transfer) {
+  std::vector<iovec> iovecs;
+  iovecs.reserve(buffers.size());
+  for (const auto& buffer : buffers) {
+    if (!buffer.empty())
+      iovecs.push_back({const_cast<std::byte*>(buffer.data()), buffer.size()});
+  }
+  size_t first = 0;
+  while (first < iovecs.size()) {
+    auto const count = static_cast<int>(std::min(iovecs.size() - first, kMaxIovecs));
+    auto res = transfer(&iovecs[first], count, static_cast<off_t>(offset));
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      return false;
+    offset += static_cast<uint64_t>(res);
+    // Skip what was transferred, the last buffer may be partial.
+    auto done = static_cast<size_t>(res);
+    while (first < iovecs.size() && done >= iovecs[first].iov_len) {
+      done -= iovecs[first].iov_len;
+      ++first;
+    }
+    if (done) {
+      iovecs[first].iov_base = static_cast<std::byte*>(iovecs[first].iov_base) + done;
+      iovecs[first].iov_len -= done;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+bool NativeFile::ReadAtV(std::span<const std::span<std::byte>> buffers, uint64_t offset) const {
+  return TransferVectored(buffers, offset,
+                          [this](const iovec* iov, int count, off_t pos) { return preadv(handle_, iov, count, pos); });
+}
+
+bool NativeFile::WriteAtV(std::span<const std::span<const std::byte>> buffers, uint64_t offset) const {
+  return TransferVectored(buffers, offset,
+                          [this](const iovec* iov, int count, off_t pos) { return pwritev(handle_, iov, count, pos); });
+}
+
+uint64_t NativeFile::Size() const {
+  struct stat st;
+  if (fstat(handle_, &st) != 0)
+    return 0;
+  return static_cast<uint64_t>(st.st_size);
+}
+
+std::vector<NativeFile::Extent> NativeFile::DataExtents(uint64_t offset, uint64_t size) const {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  std::vector<Extent> extents;
+  auto const end = offset + size;
+  auto pos = offset;
+  while (pos < end) {
+    // lseek moves the file offset, but all our I/O is positional anyway.
+    auto data = lseek(handle_, static_cast<off_t>(pos), SEEK_DATA);
+    if (data < 0) {
+      // ENXIO: no more data after pos.
+      if (errno == ENXIO)
+        break;
+      return {{offset, size}};
+    }
+    if (static_cast<uint64_t>(data) >= end)
+      break;
+    auto hole = lseek(handle_, data, SEEK_HOLE);
+    if (hole < 0)
+      return {{offset, size}};
+    auto const extent_end = std::min(static_cast<uint64_t>(hole), end);
+    extents.push_back({static_cast<uint64_t>(data), extent_end - static_cast<uint64_t>(data)});
+    pos = extent_end;
+  }
+  return extents;
+#else
+  return {{offset, size}};
+#endif
+}
+
+bool NativeFile::Resize(uint64_t size) const {
+  return ftruncate(handle_, static_cast<off_t>(size)) == 0;
+}
+
+std::span<std::byte> NativeFile::Map(uint64_t size, bool writable) {
+  Unmap();
+  if (size == 0)
+    return {};
+  auto* view =
+      mmap(nullptr, static_cast<size_t>(size), PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, handle_, 0);
+  if (view == MAP_FAILED)
+    return {};
+  mapping_ = {static_cast<std::byte*>(view), static_cast<size_t>(size)};
+  return mapping_;
+}
+
+void NativeFile::Unmap() {
+  if (!mapping_.empty())
+    munmap(mapping_.data(), mapping_.size());
+  mapping_ = {};
+}
+
+#endif
+
+std::vector<Device::SectorsExtent> NativeFile::DataSectors(uint32_t sector_address,
+                                                           uint32_t sectors_count,
+                                                           uint32_t log2_sector_size) const {
+  std::vector<Device::SectorsExtent> sectors;
+  auto const end_sector = uint64_t{sector_address} + sectors_count;
+  for (const auto& extent : DataExtents(uint64_t{sector_address} << log2_sector_size,
+                                        uint64_t{sectors_count} << log2_sector_size)) {
+    // Round outward, a partly allocated sector still has data.
+    auto const first = std::max<uint64_t>(extent.offset >> log2_sector_size, sector_address);
+    auto const last = std::min<uint64_t>(div_ceil_pow2(extent.offset + extent.size, log2_sector_size), end_sector);
+    if (first >= last)
+      continue;
+    if (!sectors.empty() && uint64_t{sectors.back().sector_address} + sectors.back().sectors_count >= first) {
+      // Touches the previous extent in the same sector.
+      sectors.back().sectors_count = static_cast<uint32_t>(last - sectors.back().sector_address);
+      continue;
+    }
+    sectors.push_back({static_cast<uint32_t>(first), static_cast<uint32_t>(last - first)});
+  }
+  return sectors;
+}
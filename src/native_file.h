@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "device.h"
+
+// Host file opened with the native OS API. All I/O is positional (pread/pwrite style), so there is no shared seek
+// state and concurrent callers don't need to be serialized.
+class NativeFile {
+ public:
+  struct Extent {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+#ifdef _WIN32
+  using native_handle_type = void*;
+#else
+  using native_handle_type = int;
+#endif
+
+  ~NativeFile();
+
+  NativeFile(const NativeFile&) = delete;
+  NativeFile& operator=(const NativeFile&) = delete;
+
+  // Returns nullptr if the file can't be opened. With |direct| the host page cache is bypassed, the buffers must then
+  // be aligned to kDirectIoAlignment and transfers must be in whole host sectors.
+  static std::unique_ptr<NativeFile> Open(const std::filesystem::path& path,
+                                          bool read_only,
+                                          bool open_create,
+                                          bool direct = false);
+
+  // Both return false if the whole buffer couldn't be transferred.
+  bool ReadAt(const std::span<std::byte>& data, uint64_t offset) const;
+  bool WriteAt(const std::span<const std::byte>& data, uint64_t offset) const;
+  // Vectored variants, the buffers are transferred back to back starting at |offset|.
+  bool ReadAtV(std::span<const std::span<std::byte>> buffers, uint64_t offset) const;
+  bool WriteAtV(std::span<const std::span<const std::byte>> buffers, uint64_t offset) const;
+
+  uint64_t Size() const;
+  // The byte ranges of [offset, offset + size) that aren't holes in a sparse file (SEEK_DATA/SEEK_HOLE, or the
+  // allocated ranges on Windows). Returns the whole range if the file system can't tell.
+  std::vector<Extent> DataExtents(uint64_t offset, uint64_t size) const;
+  // Same in whole sectors, for devices.
+  std::vector<Device::SectorsExtent> DataSectors(uint32_t sector_address,
+                                                 uint32_t sectors_count,
+                                                 uint32_t log2_sector_size) const;
+  bool Resize(uint64_t size) const;
+
+  // Maps the first |size| bytes of the file to memory, replacing the previous mapping. The mapping is owned by the file
+  // and is valid until it is unmapped or the file is destroyed. Returns an empty span on failure.
+  std::span<std::byte> Map(uint64_t size, bool writable);
+  // The file can't be resized while it is mapped on Windows.
+  void Unmap();
+
+  native_handle_type native_handle() const { return handle_; }
+
+ private:
+  NativeFile(native_handle_type handle) : handle_(handle) {}
+
+  native_handle_type handle_;
+#ifdef _WIN32
+  native_handle_type mapping_handle_{nullptr};
+#endif
+  std::span<std::byte> mapping_;
+};
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "overlay_device.h"
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "native_file.h"
+
+namespace {
+// Max sectors copied at once on commit.
+constexpr uint32_t kCommitChunkSectors = 0x100;
+}  // namespace
+
+OverlayDevice::OverlayDevice(std::shared_ptr<Device> base, const std::filesystem::path& delta_path)
+    : base_(std::move(base)), delta_(NativeFile::Open(delta_path, /*read_only=*/false, /*open_create=*/true)) {
+  if (!delta_) {
+    throw std::runtime_error("OverlayDevice: Failed to open delta file");
+  }
+  if (!delta_->Resize(0)) {
+    throw std::runtime_error("OverlayDevice: Failed to clear delta file");
+  }
+}
+
+OverlayDevice::~OverlayDevice() = default;
+
+void OverlayDevice::ReadSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) {
+  assert(data.size() == (sectors_count << Log2SectorSize()));
+  if (sector_address >= SectorsCount() || sector_address + sectors_count > SectorsCount()) {
+    throw std::runtime_error("OverlayDevice: Read out of file.");
+  }
+  auto const log2_sector_size = Log2SectorSize();
+  std::shared_lock<std::shared_mutex> guard(lock_);
+  // Split the range to runs of sectors that come from the same source.
+  uint32_t first = 0;
+  while (first < sectors_count) {
+    bool const overlaid = IsOverlaid(sector_address + first);
+    uint32_t last = first + 1;
+    while (last < sectors_count && IsOverlaid(sector_address + last) == overlaid)
+      ++last;
+    auto run = data.subspan(size_t{first} << log2_sector_size, size_t{last - first} << log2_sector_size);
+    if (overlaid) {
+      if (!delta_->ReadAt(run, static_cast<uint64_t>(sector_address + first) << log2_sector_size))
+        throw std::runtime_error("OverlayDevice: Failed to read from delta file.");
+    } else {
+      base_->ReadSectors(run, sector_address + first, last - first);
+    }
+    first = last;
+  }
+}
+
+void OverlayDevice::WriteSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) {
+  assert(data.size() == (sectors_count << Log2SectorSize()));
+  if (sector_address >= SectorsCount() || sector_address + sectors_count > SectorsCount()) {
+    throw std::runtime_error("OverlayDevice: Write out of file.");
+  }
+  std::unique_lock<std::shared_mutex> guard(lock_);
+  if (!delta_->WriteAt(data, static_cast<uint64_t>(sector_address) << Log2SectorSize()))
+    throw std::runtime_error("OverlayDevice: Failed to write to delta file.");
+  if (overlaid_sectors_.size() < size_t{sector_address} + sectors_count)
+    overlaid_sectors_.resize(size_t{sector_address} + sectors_count);
+  overlaid_sectors_.set(sector_address, sectors_count, true);
+}
+
+void OverlayDevice::Commit() {
+  if (base_->IsReadOnly()) {
+    throw std::runtime_error("OverlayDevice: Can't commit - base device is read only");
+  }
+  auto const log2_sector_size = Log2SectorSize();
+  std::unique_lock<std::shared_mutex> guard(lock_);
+  std::vector<std::byte> buffer;
+  auto sector = overlaid_sectors_.find_first();
+  while (sector != boost::dynamic_bitset<>::npos) {
+    // Copy the run of overlaid sectors that starts here, in chunks.
+    auto end = sector + 1;
+    while (end < overlaid_sectors_.size() && end - sector < kCommitChunkSectors && overlaid_sectors_.test(end))
+      ++end;
+    auto const sectors_count = static_cast<uint32_t>(end - sector);
+    buffer.resize(size_t{sectors_count} << log2_sector_size);
+    if (!delta_->ReadAt(buffer, static_cast<uint64_t>(sector) << log2_sector_size))
+      throw std::runtime_error("OverlayDevice: Failed to read from delta file.");
+    base_->WriteSectors(buffer, static_cast<uint32_t>(sector), sectors_count);
+    sector = overlaid_sectors_.find_next(end - 1);
+  }
+  DiscardLocked();
+}
+
+void OverlayDevice::Discard() {
+  std::unique_lock<std::shared_mutex> guard(lock_);
+  DiscardLocked();
+}
+
+size_t OverlayDevice::OverlaidSectorsCount() const {
+  std::shared_lock<std::shared_mutex> guard(lock_);
+  return overlaid_sectors_.count();
+}
+
+void OverlayDevice::DiscardLocked() {
+  overlaid_sectors_.clear();
+  if (!delta_->Resize(0))
+    throw std::runtime_error("OverlayDevice: Failed to clear delta file");
+}
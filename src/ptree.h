@@ -52,7 +52,7 @@ class PTree : public TreeNodesAllocator<AllocatorArgs> {
   iterator begin() const {
     if (size() == 0)
       return {this->block().get(), {}, std::nullopt};
-    std::vector<typename iterator::parent_node_info> parents;
+    typename iterator::parents_stack parents;
     uint16_t node_offset = header()->root_offset.value();
     for (int i = 0; i < header()->tree_depth.value(); ++i) {
       typename iterator::parent_node_info parent{{{this->block().get(), node_offset}}};
@@ -68,7 +68,7 @@ class PTree : public TreeNodesAllocator<AllocatorArgs> {
   iterator end() const {
     if (size() == 0)
       return {this->block().get(), {}, std::nullopt};
-    std::vector<typename iterator::parent_node_info> parents;
+    typename iterator::parents_stack parents;
     uint16_t node_offset = header()->root_offset.value();
     for (int i = 0; i < header()->tree_depth.value(); ++i) {
       typename iterator::parent_node_info parent{{{this->block().get(), node_offset}}};
@@ -92,7 +92,7 @@ class PTree : public TreeNodesAllocator<AllocatorArgs> {
   iterator find(key_type key, bool exact_match = true) const {
     if (size() == 0)
       return {this->block().get(), {}, std::nullopt};  // TODO empty tree iterator constructor
-    std::vector<typename iterator::parent_node_info> parents;
+    typename iterator::parents_stack parents;
     uint16_t node_offset = header()->root_offset.value();
     for (int i = 0; i < header()->tree_depth.value(); ++i) {
       typename iterator::parent_node_info parent{{{this->block().get(), node_offset}}};
@@ -114,7 +114,7 @@ class PTree : public TreeNodesAllocator<AllocatorArgs> {
       ++parent;
     }
     if (parent == pos.parents().rend()) {
-      if (pos.parents().size() == 4) {
+      if (pos.parents().size() == iterator::kMaxDepth) {
         // can't grow anymore in depth
         return nullptr;
       }
@@ -8,9 +8,9 @@
 #pragma once
 
 #include <iterator>
-#include <vector>
 
 #include "ptree_node.h"
+#include "small_vector.h"
 #include "tree_utils.h"
 
 template <is_parent_node_details ParentNodeDetails, is_leaf_node_details LeafNodeDetails>
@@ -26,8 +26,12 @@ class PTreeIterator {
   using parent_node_info = node_iterator_info<PTreeNode<ParentNodeDetails>>;
   using leaf_node_info = node_iterator_info<PTreeNode<LeafNodeDetails>>;
 
+  // A PTree can't grow deeper than that, so the parents never leave the iterator.
+  static constexpr size_t kMaxDepth = 4;
+  using parents_stack = SmallVector<parent_node_info, kMaxDepth>;
+
   PTreeIterator() = default;
-  PTreeIterator(Block* block, std::vector<parent_node_info> parents, std::optional<leaf_node_info> leaf)
+  PTreeIterator(Block* block, parents_stack parents, std::optional<leaf_node_info> leaf)
       : block_(block), parents_(std::move(parents)), leaf_(std::move(leaf)) {}
 
   reference operator*() const { return *leaf_->iterator; }
@@ -106,8 +110,8 @@ class PTreeIterator {
 
   leaf_node_info& leaf() { return *leaf_; }
   const leaf_node_info& leaf() const { return *leaf_; }
-  std::vector<parent_node_info>& parents() { return parents_; };
-  const std::vector<parent_node_info>& parents() const { return parents_; };
+  parents_stack& parents() { return parents_; };
+  const parents_stack& parents() const { return parents_; };
 
   bool is_begin() const {
     return !leaf_ || (std::ranges::all_of(parents_, [](const auto& parent) { return parent.iterator.is_begin(); }) &&
@@ -117,6 +121,6 @@ class PTreeIterator {
 
  private:
   Block* block_{nullptr};
-  std::vector<parent_node_info> parents_;
+  parents_stack parents_;
   std::optional<leaf_node_info> leaf_;
 };
@@ -11,6 +11,7 @@
 #include <ranges>
 
 #include "ptree_node_iterator.h"
+#include "ptree_node_search.h"
 #include "tree_utils.h"
 
 template <is_node_details T>
@@ -31,7 +32,8 @@ class PTreeNode {
   bool full() const { return size() == node_values_capacity<T>::value; }
 
   iterator find(key_type key, bool exact_match) {
-    auto it = std::upper_bound(begin(), end(), key);
+    auto const upper_bound = node_full_keys_upper_bound(*node_.get(), size(), key);
+    auto it = begin() + static_cast<typename iterator::difference_type>(upper_bound);
     if (it != begin())
       --it;
     if (exact_match && (it == end() || (*it).key() != key))
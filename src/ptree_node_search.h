@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <bit>
+#include <cassert>
+#include <climits>
+#include <cstddef>
+
+#include "tree_utils.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define WFSLIB_PTREE_NODE_SEARCH_SIMD
+#include <emmintrin.h>
+#if defined(__SSSE3__) || defined(__AVX__)
+#define WFSLIB_PTREE_NODE_SEARCH_SSSE3
+#include <tmmintrin.h>
+#endif
+#endif
+
+// Returns how many of the first keys_count keys of the node are less than or equal to key. The keys of a node are
+// sorted, so this is also the upper bound of key.
+template <has_keys T>
+size_t node_keys_upper_bound_scalar(const T& node, size_t keys_count, key_type key) {
+  assert(keys_count <= node_keys_capacity<T>::value);
+  size_t count = 0;
+  while (count < keys_count && node_get_key(node, count) <= key)
+    ++count;
+  return count;
+}
+
+#ifdef WFSLIB_PTREE_NODE_SEARCH_SIMD
+namespace ptree_node_search {
+
+inline __m128i ByteSwap32(__m128i values) {
+#ifdef WFSLIB_PTREE_NODE_SEARCH_SSSE3
+  return _mm_shuffle_epi8(values, _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+#else
+  values = _mm_or_si128(_mm_slli_epi16(values, 8), _mm_srli_epi16(values, 8));
+  values = _mm_shufflelo_epi16(values, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_shufflehi_epi16(values, _MM_SHUFFLE(2, 3, 0, 1));
+#endif
+}
+
+// Bit i is set if the big endian key in lane i is less than or equal to key. SSE2 only compares signed integers, so
+// both sides are biased by INT_MIN.
+inline unsigned LessEqualMask(const std::byte* keys, __m128i biased_key) {
+  auto const values = ByteSwap32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys)));
+  auto const greater = _mm_cmpgt_epi32(_mm_xor_si128(values, _mm_set1_epi32(INT_MIN)), biased_key);
+  return ~static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(greater))) & 0xf;
+}
+
+}  // namespace ptree_node_search
+
+// Same as node_keys_upper_bound_scalar, but compares all the keys at once.
+template <has_keys T>
+size_t node_keys_upper_bound_simd(const T& node, size_t keys_count, key_type key) {
+  constexpr size_t kKeysCapacity = node_keys_capacity<T>::value;
+  static_assert(kKeysCapacity <= 8);
+  // The second load may read past the keys, but not past the node.
+  static_assert(kKeysCapacity <= 4 || sizeof(T) >= 32);
+  assert(keys_count <= kKeysCapacity);
+  auto const* keys = reinterpret_cast<const std::byte*>(&node.keys[0]);
+  auto const biased_key = _mm_set1_epi32(static_cast<int>(key ^ 0x80000000u));
+  unsigned mask = ptree_node_search::LessEqualMask(keys, biased_key);
+  if constexpr (kKeysCapacity > 4)
+    mask |= ptree_node_search::LessEqualMask(keys + 16, biased_key) << 4;
+  return static_cast<size_t>(std::popcount(mask & ((1u << keys_count) - 1)));
+}
+#endif
+
+template <has_keys T>
+size_t node_keys_upper_bound(const T& node, size_t keys_count, key_type key) {
+#ifdef WFSLIB_PTREE_NODE_SEARCH_SIMD
+  return node_keys_upper_bound_simd(node, keys_count, key);
+#else
+  return node_keys_upper_bound_scalar(node, keys_count, key);
+#endif
+}
+
+// Upper bound of key in the full keys of a node with values_count values, see node_get_full_key.
+template <is_node_details T>
+size_t node_full_keys_upper_bound(const T& node, size_t values_count, key_type key);
+template <is_parent_node_details T>
+size_t node_full_keys_upper_bound(const T& node, size_t values_count, key_type key) {
+  // Empty nodes only come from corrupted images, but they must not underflow the keys count.
+  if (values_count == 0)
+    return 0;
+  // The first full key is always 0.
+  return 1 + node_keys_upper_bound(node, values_count - 1, key);
+}
+template <is_leaf_node_details T>
+size_t node_full_keys_upper_bound(const T& node, size_t values_count, key_type key) {
+  return node_keys_upper_bound(node, values_count, key);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "retained_blocks_cache.h"
+
+#include "block.h"
+
+void RetainedBlocksCache::SetBudget(size_t bytes) {
+  budget_ = bytes;
+  if (budget_ == 0) {
+    entries_.clear();
+    fifo_queue_.clear();
+    main_queue_.clear();
+    ghosts_.clear();
+    ghosts_index_.clear();
+    size_ = fifo_size_ = 0;
+    return;
+  }
+  EvictToBudget();
+}
+
+void RetainedBlocksCache::Insert(uint32_t block_number, Entry entry, bool reused) {
+  if (entry.data.size() > budget_)
+    return;
+  if (auto it = entries_.find(block_number); it != entries_.end())
+    Erase(it);
+  if (auto ghost = ghosts_index_.find(block_number); ghost != ghosts_index_.end()) {
+    ghosts_.erase(ghost->second);
+    ghosts_index_.erase(ghost);
+    reused = true;
+  }
+  auto& queue = reused ? main_queue_ : fifo_queue_;
+  queue.push_front(block_number);
+  auto const size = entry.data.size();
+  entries_.insert({block_number, {std::move(entry), reused, queue.begin()}});
+  size_ += size;
+  if (!reused)
+    fifo_size_ += size;
+  EvictToBudget();
+}
+
+std::optional<RetainedBlocksCache::Entry> RetainedBlocksCache::Take(uint32_t block_number) {
+  auto it = entries_.find(block_number);
+  if (it == entries_.end())
+    return std::nullopt;
+  return Erase(it);
+}
+
+void RetainedBlocksCache::Invalidate(uint32_t block_number, uint32_t blocks_count) {
+  EraseOverlappingBlocks(
+      entries_, block_number, blocks_count, [](const Node& node) { return node.entry.blocks_count; },
+      [this](Entries::iterator it) { Erase(it); });
+}
+
+RetainedBlocksCache::Entry RetainedBlocksCache::Erase(Entries::iterator it) {
+  auto node = std::move(entries_.extract(it).mapped());
+  auto const size = node.entry.data.size();
+  size_ -= size;
+  if (node.in_main_queue) {
+    main_queue_.erase(node.position);
+  } else {
+    fifo_queue_.erase(node.position);
+    fifo_size_ -= size;
+  }
+  return std::move(node.entry);
+}
+
+void RetainedBlocksCache::EvictToBudget() {
+  while (size_ > budget_) {
+    // The FIFO queue gets a quarter of the budget, unless there is nothing else to evict.
+    if (!fifo_queue_.empty() && (fifo_size_ > budget_ / 4 || main_queue_.empty())) {
+      auto const block_number = fifo_queue_.back();
+      Erase(entries_.find(block_number));
+      AddGhost(block_number);
+    } else {
+      Erase(entries_.find(main_queue_.back()));
+    }
+  }
+}
+
+void RetainedBlocksCache::AddGhost(uint32_t block_number) {
+  // Remember as many evicted blocks as half of the physical blocks that fit in the budget.
+  auto const max_ghosts = budget_ >> (log2_size(BlockSize::Physical) + 1);
+  if (max_ghosts == 0)
+    return;
+  ghosts_.push_front(block_number);
+  ghosts_index_[block_number] = ghosts_.begin();
+  while (ghosts_.size() > max_ghosts) {
+    ghosts_index_.erase(ghosts_.back());
+    ghosts_.pop_back();
+  }
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <optional>
+#include <unordered_map>
+
+#include "block_buffer_pool.h"
+#include "device_encryption.h"
+
+// Decrypted and verified data of released clean blocks, bounded by a byte budget. Uses the 2Q policy: blocks that are
+// released for the first time enter a small FIFO queue, and only blocks that are loaded again from it move to the main
+// LRU queue, so a single scan over many blocks doesn't evict the hot ones. The block numbers that were recently evicted
+// from the FIFO queue are remembered, so a block that comes back after them also goes to the main queue.
+class RetainedBlocksCache {
+ public:
+  struct Entry {
+    BlockBuffer data;
+    // Size in physical blocks.
+    uint32_t blocks_count;
+    uint32_t iv;
+    bool encrypted;
+    // The hash that the data was verified against, if it is stored outside of the block.
+    std::optional<std::array<std::byte, DeviceEncryption::DIGEST_SIZE>> external_hash;
+  };
+
+  size_t budget() const { return budget_; }
+  size_t size() const { return size_; }
+  // Evicts entries as needed. 0 disables the cache and drops everything in it.
+  void SetBudget(size_t bytes);
+
+  // |reused| should be set if the block was loaded from this cache before.
+  void Insert(uint32_t block_number, Entry entry, bool reused);
+  // Removes the entry of the block and returns it.
+  std::optional<Entry> Take(uint32_t block_number);
+  // Drops the entries that overlap the physical blocks [block_number, block_number + blocks_count).
+  void Invalidate(uint32_t block_number, uint32_t blocks_count);
+
+ private:
+  using Queue = std::list<uint32_t>;
+
+  struct Node {
+    Entry entry;
+    bool in_main_queue;
+    Queue::iterator position;
+  };
+
+  using Entries = std::map<uint32_t, Node>;
+
+  Entry Erase(Entries::iterator it);
+  void EvictToBudget();
+  void AddGhost(uint32_t block_number);
+
+  size_t budget_{0};
+  size_t size_{0};
+  size_t fifo_size_{0};
+
+  Entries entries_;
+  // Most recent first.
+  Queue fifo_queue_;
+  Queue main_queue_;
+  Queue ghosts_;
+  std::unordered_map<uint32_t, Queue::iterator> ghosts_index_;
+};
@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "sha1.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define WFSLIB_SHA1_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#include <cpuid.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+static_assert(Sha1::DIGEST_SIZE == CryptoPP::SHA1::DIGESTSIZE);
+
+namespace {
+
+constexpr size_t kChunkSize = 64;
+constexpr std::array<uint32_t, 5> kInitialState = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+struct CpuFeatures {
+  bool avx2;
+  bool sha;
+};
+
+CpuFeatures DetectCpuFeatures() {
+#if defined(WFSLIB_SHA1_X86) && defined(_MSC_VER)
+  int regs[4];
+  __cpuid(regs, 0);
+  if (regs[0] < 7)
+    return {false, false};
+  __cpuid(regs, 1);
+  // The OS must save the YMM registers too.
+  bool const ymm_enabled = (regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+  __cpuidex(regs, 7, 0);
+  return {ymm_enabled && (regs[1] & (1 << 5)), (regs[1] & (1 << 29)) != 0};
+#elif defined(WFSLIB_SHA1_X86)
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    return {false, false};
+  return {__builtin_cpu_supports("avx2") != 0, (ebx & (1u << 29)) != 0};
+#else
+  return {false, false};
+#endif
+}
+
+void HashGeneric(const Sha1::BlockHash& block) {
+  assert(block.placeholder_offset == Sha1::kNoPlaceholder ||
+         block.placeholder_offset + Sha1::DIGEST_SIZE <= block.data.size());
+  Sha1::Stream stream(block.placeholder_offset);
+  stream.Update(block.data);
+  stream.Final(block.digest);
+}
+
+#ifdef WFSLIB_SHA1_X86
+
+// A block that is hashed in one of the lanes, fed in chunks of the padded message.
+struct LaneMessage {
+  const Sha1::BlockHash* block{nullptr};
+  size_t offset;
+  size_t padded_size;
+
+  void Reset(const Sha1::BlockHash& new_block) {
+    block = &new_block;
+    offset = 0;
+    padded_size = (new_block.data.size() + 8) / kChunkSize * kChunkSize + kChunkSize;
+  }
+
+  // Returns the next chunk, straight from the block unless it has the placeholder or the padding.
+  const std::byte* NextChunk(std::array<std::byte, kChunkSize>& scratch) const {
+    auto const size = block->data.size();
+    auto const placeholder = block->placeholder_offset;
+    bool const in_placeholder = placeholder != Sha1::kNoPlaceholder && offset < placeholder + Sha1::DIGEST_SIZE &&
+                                placeholder < offset + kChunkSize;
+    if (offset + kChunkSize <= size && !in_placeholder)
+      return block->data.data() + offset;
+    uint64_t const size_in_bits = uint64_t{size} * 8;
+    for (size_t i = 0; i < kChunkSize; ++i) {
+      auto const pos = offset + i;
+      if (pos < size)
+        scratch[i] = placeholder != Sha1::kNoPlaceholder && pos >= placeholder && pos < placeholder + Sha1::DIGEST_SIZE
+                         ? std::byte{0xFF}
+                         : block->data[pos];
+      else if (pos == size)
+        scratch[i] = std::byte{0x80};
+      else if (pos >= padded_size - 8)
+        scratch[i] = static_cast<std::byte>(size_in_bits >> ((padded_size - 1 - pos) * 8));
+      else
+        scratch[i] = std::byte{0};
+    }
+    return scratch.data();
+  }
+};
+
+template <int N>
+AVX2_TARGET inline __m256i Rotl(__m256i x) {
+  return _mm256_or_si256(_mm256_slli_epi32(x, N), _mm256_srli_epi32(x, 32 - N));
+}
+
+// rows[i] holds 8 words of lane i, turns it to rows[i] holding word i of the 8 lanes.
+AVX2_TARGET inline void Transpose8x8(__m256i (&rows)[8]) {
+  __m256i t0 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+  __m256i t1 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+  __m256i t2 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+  __m256i t3 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+  __m256i t4 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+  __m256i t5 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+  __m256i t6 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+  __m256i t7 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+  __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+  __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+  __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+  __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+  __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+  __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+  __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+  __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+  rows[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+  rows[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+  rows[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+  rows[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+  rows[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+  rows[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+  rows[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+  rows[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+// One SHA-1 compression of a chunk in each of the 8 lanes. |state| is word major.
+AVX2_TARGET void CompressAvx2(std::array<std::array<uint32_t, 8>, 5>& state,
+                              const std::array<const std::byte*, 8>& chunks) {
+  const __m256i byte_swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5,
+                                             4, 11, 10, 9, 8, 15, 14, 13, 12);
+  __m256i w[16];
+  for (size_t half = 0; half < 2; ++half) {
+    __m256i rows[8];
+    for (size_t lane = 0; lane < 8; ++lane)
+      rows[lane] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunks[lane] + half * 32));
+    Transpose8x8(rows);
+    for (size_t i = 0; i < 8; ++i)
+      w[half * 8 + i] = _mm256_shuffle_epi8(rows[i], byte_swap);
+  }
+
+  __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state[0].data()));
+  __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state[1].data()));
+  __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state[2].data()));
+  __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state[3].data()));
+  __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state[4].data()));
+  const __m256i a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;
+
+  for (size_t t = 0; t < 80; ++t) {
+    if (t >= 16) {
+      w[t & 15] = Rotl<1>(_mm256_xor_si256(_mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]),
+                                           _mm256_xor_si256(w[(t - 14) & 15], w[t & 15])));
+    }
+    __m256i f, k;
+    if (t < 20) {
+      f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+      k = _mm256_set1_epi32(0x5A827999);
+    } else if (t < 40) {
+      f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+      k = _mm256_set1_epi32(0x6ED9EBA1);
+    } else if (t < 60) {
+      f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+      k = _mm256_set1_epi32(static_cast<int>(0x8F1BBCDC));
+    } else {
+      f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+      k = _mm256_set1_epi32(static_cast<int>(0xCA62C1D6));
+    }
+    __m256i temp =
+        _mm256_add_epi32(_mm256_add_epi32(Rotl<5>(a), f), _mm256_add_epi32(_mm256_add_epi32(e, k), w[t & 15]));
+    e = d;
+    d = c;
+    c = Rotl<30>(b);
+    b = a;
+    a = temp;
+  }
+
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(state[0].data()), _mm256_add_epi32(a, a0));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(state[1].data()), _mm256_add_epi32(b, b0));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(state[2].data()), _mm256_add_epi32(c, c0));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(state[3].data()), _mm256_add_epi32(d, d0));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(state[4].data()), _mm256_add_epi32(e, e0));
+}
+
+void HashAvx2MultiBuffer(std::span<const Sha1::BlockHash> blocks) {
+  constexpr size_t kLanes = 8;
+  static const std::array<std::byte, kChunkSize> idle_chunk{};
+  std::array<LaneMessage, kLanes> lanes;
+  std::array<std::array<uint32_t, kLanes>, 5> state;
+  std::array<std::array<std::byte, kChunkSize>, kLanes> scratch;
+  std::array<const std::byte*, kLanes> chunks;
+
+  auto next_block = blocks.begin();
+  size_t active = 0;
+  while (true) {
+    // Each finished lane is refilled with the next block.
+    for (size_t lane = 0; lane < kLanes && next_block != blocks.end(); ++lane) {
+      if (lanes[lane].block)
+        continue;
+      lanes[lane].Reset(*next_block++);
+      for (size_t i = 0; i < state.size(); ++i)
+        state[i][lane] = kInitialState[i];
+      ++active;
+    }
+    if (active == 0)
+      break;
+
+    for (size_t lane = 0; lane < kLanes; ++lane)
+      chunks[lane] = lanes[lane].block ? lanes[lane].NextChunk(scratch[lane]) : idle_chunk.data();
+    CompressAvx2(state, chunks);
+
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+      auto& message = lanes[lane];
+      if (!message.block)
+        continue;
+      message.offset += kChunkSize;
+      if (message.offset < message.padded_size)
+        continue;
+      for (size_t i = 0; i < state.size(); ++i) {
+        for (size_t j = 0; j < 4; ++j)
+          message.block->digest[i * 4 + j] = static_cast<std::byte>(state[i][lane] >> (24 - j * 8));
+      }
+      message.block = nullptr;
+      --active;
+    }
+  }
+}
+
+#endif  // WFSLIB_SHA1_X86
+
+}  // namespace
+
+void Sha1::Stream::Update(std::span<const std::byte> data) {
+  static const std::array<uint8_t, DIGEST_SIZE> placeholder = [] {
+    std::array<uint8_t, DIGEST_SIZE> bytes;
+    bytes.fill(0xFF);
+    return bytes;
+  }();
+  while (!data.empty()) {
+    size_t size;
+    if (placeholder_offset_ == kNoPlaceholder || offset_ >= placeholder_offset_ + DIGEST_SIZE) {
+      size = data.size();
+      sha1_.Update(reinterpret_cast<const uint8_t*>(data.data()), size);
+    } else if (offset_ < placeholder_offset_) {
+      size = std::min(data.size(), placeholder_offset_ - offset_);
+      sha1_.Update(reinterpret_cast<const uint8_t*>(data.data()), size);
+    } else {
+      size = std::min(data.size(), placeholder_offset_ + DIGEST_SIZE - offset_);
+      sha1_.Update(placeholder.data(), size);
+    }
+    data = data.subspan(size);
+    offset_ += size;
+  }
+}
+
+void Sha1::Stream::Final(std::span<std::byte> digest) {
+  assert(digest.size() == DIGEST_SIZE);
+  sha1_.Final(reinterpret_cast<uint8_t*>(digest.data()));
+}
+
+// static
+void Sha1::Hash(const BlockHash& block) {
+  HashGeneric(block);
+}
+
+// static
+void Sha1::HashBlocks(std::span<const BlockHash> blocks) {
+  // Below this, most of the lanes would be idle.
+  constexpr size_t kMinMultiBufferBlocks = 4;
+  HashBlocks(blocks, blocks.size() >= kMinMultiBufferBlocks ? BestKernel() : Kernel::Generic);
+}
+
+// static
+void Sha1::HashBlocks(std::span<const BlockHash> blocks, Kernel kernel) {
+  switch (kernel) {
+#ifdef WFSLIB_SHA1_X86
+    case Kernel::Avx2MultiBuffer:
+      HashAvx2MultiBuffer(blocks);
+      return;
+#endif
+    default:
+      for (const auto& block : blocks)
+        HashGeneric(block);
+      return;
+  }
+}
+
+// static
+Sha1::Kernel Sha1::BestKernel() {
+  // The SHA extensions (used by CryptoPP) are faster than eight lanes.
+  static const Kernel kernel = [] {
+    auto const features = DetectCpuFeatures();
+    return features.avx2 && !features.sha ? Kernel::Avx2MultiBuffer : Kernel::Generic;
+  }();
+  return kernel;
+}
+
+// static
+std::vector<Sha1::Kernel> Sha1::SupportedKernels() {
+  std::vector<Kernel> kernels{Kernel::Generic};
+  if (DetectCpuFeatures().avx2)
+    kernels.push_back(Kernel::Avx2MultiBuffer);
+  return kernels;
+}
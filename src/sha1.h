@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <cryptopp/sha.h>
+#include <cstddef>
+#include <limits>
+#include <span>
+#include <vector>
+
+// SHA-1 of blocks, with the fastest implementation that the host supports.
+class Sha1 {
+ public:
+  static constexpr size_t DIGEST_SIZE = 20;
+  static constexpr size_t kNoPlaceholder = std::numeric_limits<size_t>::max();
+
+  enum class Kernel {
+    // CryptoPP, one block at a time. It uses the SHA extensions of the CPU when it has them.
+    Generic,
+    // Eight blocks at a time, each in a 32-bit lane of the AVX2 registers.
+    Avx2MultiBuffer,
+  };
+
+  struct BlockHash {
+    std::span<const std::byte> data;
+    // Offset of a hash that is stored in the block itself, it is hashed as 0xFF bytes.
+    size_t placeholder_offset;
+    // DIGEST_SIZE bytes, written once the whole block was hashed.
+    std::span<std::byte> digest;
+  };
+
+  // Hashes a block that is fed in order, piece by piece, for hashing data as soon as it is ready.
+  class Stream {
+   public:
+    explicit Stream(size_t placeholder_offset = kNoPlaceholder) : placeholder_offset_(placeholder_offset) {}
+
+    void Update(std::span<const std::byte> data);
+    void Final(std::span<std::byte> digest);
+
+   private:
+    CryptoPP::SHA1 sha1_;
+    size_t placeholder_offset_;
+    size_t offset_{0};
+  };
+
+  static void Hash(const BlockHash& block);
+  // The digests must not be in the data of other blocks of the batch.
+  static void HashBlocks(std::span<const BlockHash> blocks);
+  static void HashBlocks(std::span<const BlockHash> blocks, Kernel kernel);
+
+  // The kernel that is used for batches, picked once from the CPU features.
+  static Kernel BestKernel();
+  static std::vector<Kernel> SupportedKernels();
+};
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Vector that keeps up to N elements inline and only allocates when it grows beyond that.
+// Used for the per-level stacks of the tree iterators, which are almost always shallow.
+template <typename T, size_t N>
+class SmallVector {
+ public:
+  static_assert(N > 0);
+
+  using value_type = T;
+  using size_type = size_t;
+  using difference_type = ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using iterator = T*;
+  using const_iterator = const T*;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  SmallVector() = default;
+  SmallVector(const SmallVector& other) { CopyFrom(other); }
+  SmallVector(SmallVector&& other) noexcept(std::is_nothrow_move_constructible_v<T>) { MoveFrom(other); }
+  ~SmallVector() { Release(); }
+
+  SmallVector& operator=(const SmallVector& other) {
+    if (this != &other) {
+      clear();
+      CopyFrom(other);
+    }
+    return *this;
+  }
+
+  SmallVector& operator=(SmallVector&& other) noexcept(std::is_nothrow_move_constructible_v<T>) {
+    if (this != &other) {
+      Release();
+      MoveFrom(other);
+    }
+    return *this;
+  }
+
+  T* data() { return heap_ ? heap_ : inline_data(); }
+  const T* data() const { return heap_ ? heap_ : inline_data(); }
+  size_t size() const { return size_; }
+  size_t capacity() const { return heap_ ? heap_capacity_ : N; }
+  bool empty() const { return size_ == 0; }
+
+  iterator begin() { return data(); }
+  iterator end() { return data() + size_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+  const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+  T& operator[](size_t index) {
+    assert(index < size_);
+    return data()[index];
+  }
+  const T& operator[](size_t index) const {
+    assert(index < size_);
+    return data()[index];
+  }
+  T& front() { return (*this)[0]; }
+  const T& front() const { return (*this)[0]; }
+  T& back() { return (*this)[size_ - 1]; }
+  const T& back() const { return (*this)[size_ - 1]; }
+
+  void reserve(size_t new_capacity) {
+    if (new_capacity > capacity())
+      Reallocate(new_capacity, nullptr);
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    if (size_ == capacity()) {
+      // Construct the new element before moving the old ones, the arguments may refer to them.
+      Reallocate(capacity() * 2, [&](T* slot) { std::construct_at(slot, std::forward<Args>(args)...); });
+    } else {
+      std::construct_at(data() + size_, std::forward<Args>(args)...);
+    }
+    return data()[size_++];
+  }
+  void push_back(const T& value) { emplace_back(value); }
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+
+  void pop_back() {
+    assert(size_ > 0);
+    std::destroy_at(data() + --size_);
+  }
+
+  void clear() {
+    std::destroy(begin(), end());
+    size_ = 0;
+  }
+
+ private:
+  T* inline_data() { return std::launder(reinterpret_cast<T*>(inline_)); }
+  const T* inline_data() const { return std::launder(reinterpret_cast<const T*>(inline_)); }
+
+  // Moves the elements to a new heap buffer. If emplace is set, it constructs one extra element at the end first.
+  template <typename Emplace>
+  void Reallocate(size_t new_capacity, Emplace emplace) {
+    std::allocator<T> allocator;
+    T* new_data = allocator.allocate(new_capacity);
+    try {
+      if constexpr (!std::is_null_pointer_v<Emplace>)
+        emplace(new_data + size_);
+    } catch (...) {
+      allocator.deallocate(new_data, new_capacity);
+      throw;
+    }
+    std::uninitialized_move(begin(), end(), new_data);
+    std::destroy(begin(), end());
+    if (heap_)
+      allocator.deallocate(heap_, heap_capacity_);
+    heap_ = new_data;
+    heap_capacity_ = new_capacity;
+  }
+
+  void CopyFrom(const SmallVector& other) {
+    reserve(other.size_);
+    std::uninitialized_copy(other.begin(), other.end(), data());
+    size_ = other.size_;
+  }
+
+  void MoveFrom(SmallVector& other) {
+    if (other.heap_) {
+      heap_ = std::exchange(other.heap_, nullptr);
+      heap_capacity_ = std::exchange(other.heap_capacity_, 0);
+      size_ = std::exchange(other.size_, 0);
+      return;
+    }
+    std::uninitialized_move(other.begin(), other.end(), inline_data());
+    size_ = other.size_;
+    other.clear();
+  }
+
+  void Release() {
+    clear();
+    if (heap_)
+      std::allocator<T>().deallocate(std::exchange(heap_, nullptr), heap_capacity_);
+    heap_capacity_ = 0;
+  }
+
+  alignas(T) std::byte inline_[N * sizeof(T)];
+  T* heap_{nullptr};
+  size_t heap_capacity_{0};
+  size_t size_{0};
+};
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <exception>
+
+struct ThreadPool::Job {
+  const std::function<void(size_t)>* task;
+  size_t count;
+  std::atomic<size_t> next_index{0};
+
+  std::mutex lock;
+  std::condition_variable done;
+  size_t completed{0};
+  std::exception_ptr error;
+};
+
+ThreadPool::ThreadPool(size_t threads_count) {
+  threads_.reserve(threads_count);
+  for (size_t i = 0; i < threads_count; ++i)
+    threads_.emplace_back(&ThreadPool::WorkerThread, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stop_ = true;
+  }
+  jobs_changed_.notify_all();
+  for (auto& thread : threads_)
+    thread.join();
+}
+
+// static
+ThreadPool& ThreadPool::Shared() {
+  constexpr size_t kMaxThreads = 4;
+  // Never destroyed, so it can still be used during static destruction.
+  static auto* pool = new ThreadPool(std::min<size_t>(std::thread::hardware_concurrency(), kMaxThreads));
+  return *pool;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& task) {
+  if (count == 0)
+    return;
+  auto job = std::make_shared<Job>();
+  job->task = &task;
+  job->count = count;
+  if (count > 1 && !threads_.empty()) {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      // A worker for each task besides the one of the calling thread.
+      for (size_t i = 0; i < std::min(count - 1, threads_.size()); ++i)
+        jobs_.push_back(job);
+    }
+    jobs_changed_.notify_all();
+  }
+  RunJob(*job);
+  std::unique_lock<std::mutex> guard(job->lock);
+  job->done.wait(guard, [&] { return job->completed == count; });
+  if (job->error)
+    std::rethrow_exception(job->error);
+}
+
+void ThreadPool::Post(std::function<void()> task) {
+  assert(!threads_.empty());
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    tasks_.push_back(std::move(task));
+  }
+  jobs_changed_.notify_one();
+}
+
+void ThreadPool::WorkerThread() {
+  std::unique_lock<std::mutex> guard(lock_);
+  while (true) {
+    jobs_changed_.wait(guard, [this] { return stop_ || !jobs_.empty() || !tasks_.empty(); });
+    if (!jobs_.empty()) {
+      auto job = std::move(jobs_.front());
+      jobs_.pop_front();
+      guard.unlock();
+      RunJob(*job);
+      guard.lock();
+    } else if (!tasks_.empty()) {
+      auto task = std::move(tasks_.front());
+      tasks_.pop_front();
+      guard.unlock();
+      task();
+      guard.lock();
+    } else {
+      return;  // stopped
+    }
+  }
+}
+
+// static
+void ThreadPool::RunJob(Job& job) {
+  while (true) {
+    auto const index = job.next_index.fetch_add(1);
+    if (index >= job.count)
+      return;
+    std::exception_ptr error;
+    try {
+      (*job.task)(index);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> guard(job.lock);
+    if (error && !job.error)
+      job.error = error;
+    if (++job.completed == job.count)
+      job.done.notify_all();
+  }
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small pool of worker threads for splitting CPU bound work, such as the decryption of a large block.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t threads_count);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Shared by the library, with a worker for each core up to 4, besides the calling thread.
+  static ThreadPool& Shared();
+
+  size_t threads_count() const { return threads_.size(); }
+
+  // Runs task(0) to task(count - 1) on the workers and on the calling thread, and waits for all of them. Rethrows the
+  // first exception that a task threw.
+  void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+  // Runs the task on one of the workers without waiting for it, the pool must have workers. The task must not throw.
+  // Tasks that are queued when the pool is destroyed still run.
+  void Post(std::function<void()> task);
+
+ private:
+  struct Job;
+
+  void WorkerThread();
+  static void RunJob(Job& job);
+
+  std::mutex lock_;
+  std::condition_variable jobs_changed_;
+  std::deque<std::shared_ptr<Job>> jobs_;
+  std::deque<std::function<void()>> tasks_;
+  bool stop_{false};
+  std::vector<std::thread> threads_;
+};
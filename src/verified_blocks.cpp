@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "verified_blocks.h"
+
+#include "block.h"
+#include "utils.h"
+
+void VerifiedBlocks::SetCapacity(size_t blocks_count) {
+  capacity_ = blocks_count;
+  while (entries_.size() > capacity_)
+    Erase(entries_.find(queue_.front()));
+}
+
+bool VerifiedBlocks::Contains(uint32_t block_number, uint32_t size, uint32_t iv, bool encrypted) const {
+  auto it = entries_.find(block_number);
+  return it != entries_.end() && it->second.entry.size == size && it->second.entry.iv == iv &&
+         it->second.entry.encrypted == encrypted;
+}
+
+bool VerifiedBlocks::Contains(uint32_t block_number, const Entry& entry) const {
+  auto it = entries_.find(block_number);
+  return it != entries_.end() && it->second.entry == entry;
+}
+
+void VerifiedBlocks::Insert(uint32_t block_number, const Entry& entry) {
+  if (capacity_ == 0)
+    return;
+  if (auto it = entries_.find(block_number); it != entries_.end())
+    Erase(it);
+  queue_.push_back(block_number);
+  entries_.insert({block_number, {entry, std::prev(queue_.end())}});
+  if (entries_.size() > capacity_)
+    Erase(entries_.find(queue_.front()));
+}
+
+void VerifiedBlocks::Invalidate(uint32_t block_number, uint32_t blocks_count) {
+  EraseOverlappingBlocks(
+      entries_, block_number, blocks_count,
+      [](const Node& node) { return div_ceil_pow2(node.entry.size, log2_size(BlockSize::Physical)); },
+      [this](Entries::iterator it) { Erase(it); });
+}
+
+void VerifiedBlocks::Erase(Entries::iterator it) {
+  queue_.erase(it->second.position);
+  entries_.erase(it);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+
+#include "device_encryption.h"
+
+// The hashes that blocks were verified against since they were last written, bounded by a number of blocks. A block
+// that is read again with the same parameters and still has the same hash doesn't have to be hashed again. The oldest
+// entries are evicted first.
+class VerifiedBlocks {
+ public:
+  struct Entry {
+    // Size of the data, in bytes.
+    uint32_t size;
+    uint32_t iv;
+    bool encrypted;
+    std::array<std::byte, DeviceEncryption::DIGEST_SIZE> hash;
+
+    bool operator==(const Entry& other) const = default;
+  };
+
+  size_t capacity() const { return capacity_; }
+  size_t size() const { return entries_.size(); }
+  // Evicts entries as needed. 0 disables it and drops everything in it.
+  void SetCapacity(size_t blocks_count);
+
+  // Whether the block was verified with these parameters, whatever its hash was.
+  bool Contains(uint32_t block_number, uint32_t size, uint32_t iv, bool encrypted) const;
+  bool Contains(uint32_t block_number, const Entry& entry) const;
+  void Insert(uint32_t block_number, const Entry& entry);
+  // Drops the entries that overlap the physical blocks [block_number, block_number + blocks_count).
+  void Invalidate(uint32_t block_number, uint32_t blocks_count);
+
+ private:
+  using Queue = std::list<uint32_t>;
+
+  struct Node {
+    Entry entry;
+    Queue::iterator position;
+  };
+
+  using Entries = std::map<uint32_t, Node>;
+
+  void Erase(Entries::iterator it);
+
+  size_t capacity_{0};
+  Entries entries_;
+  // Oldest first.
+  Queue queue_;
+};
@@ -146,6 +146,17 @@ std::expected<std::shared_ptr<Block>, WfsError> WfsDevice::LoadMetadataBlock(con
                                   !new_block);
 }
 
+std::expected<std::vector<std::shared_ptr<Block>>, WfsError> WfsDevice::LoadMetadataBlocks(
+    const Area* area,
+    std::span<const uint32_t> physical_block_numbers,
+    BlockSize block_size) const {
+  std::vector<uint32_t> ivs;
+  ivs.reserve(physical_block_numbers.size());
+  for (auto physical_block_number : physical_block_numbers)
+    ivs.push_back(CalcIV(area, physical_block_number));
+  return Block::LoadMetadataBlocks(device_, physical_block_numbers, block_size, ivs);
+}
+
 std::expected<std::shared_ptr<Block>, WfsError> WfsDevice::LoadDataBlock(const Area* area,
                                                                          uint32_t physical_block_number,
                                                                          BlockSize block_size,
@@ -158,6 +169,16 @@ std::expected<std::shared_ptr<Block>, WfsError> WfsDevice::LoadDataBlock(const A
                               CalcIV(area, physical_block_number), std::move(data_hash), encrypted, !new_block);
 }
 
+std::expected<bool, WfsError> WfsDevice::ReadDataBlockRange(const Area* area,
+                                                            uint32_t physical_block_number,
+                                                            uint32_t data_size,
+                                                            bool encrypted,
+                                                            size_t offset,
+                                                            std::span<std::byte> output) const {
+  return Block::ReadDataBlockRange(device_, physical_block_number, data_size, CalcIV(area, physical_block_number),
+                                   encrypted, offset, output);
+}
+
 uint32_t WfsDevice::CalcIV(const Area* area, uint32_t physical_block_number) const {
   return (area->header()->iv.value() ^ header()->iv.value()) +
          ((physical_block_number - area->physical_block_number())
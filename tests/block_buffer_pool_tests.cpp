@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "block_buffer_pool.h"
+
+TEST_CASE("BlockBufferPool gives back the slabs whose buffers are all free", "[block-buffer-pool][unit]") {
+  auto& pool = BlockBufferPool::Get();
+  // A size class that the other tests rarely use, in case they left buffers of it.
+  constexpr size_t kBufferSize = 0x40000;
+  constexpr size_t kBuffersPerSlab = BlockBufferPool::kSlabSize / kBufferSize;
+  auto const initial_size = pool.SlabsSize();
+
+  std::vector<std::byte*> buffers;
+  for (size_t i = 0; i < 4 * kBuffersPerSlab; ++i) {
+    buffers.push_back(pool.Allocate(kBufferSize));
+    // Touch the memory, so it is really in use.
+    std::ranges::fill(std::span{buffers.back(), kBufferSize}, std::byte{0x5a});
+  }
+  CHECK(pool.SlabsSize() >= initial_size + 3 * BlockBufferPool::kSlabSize);
+
+  for (auto* buffer : buffers)
+    pool.Free(buffer, kBufferSize);
+  // A single empty slab is kept for the next allocations.
+  CHECK(pool.SlabsSize() <= initial_size + BlockBufferPool::kSlabSize);
+}
@@ -6,19 +6,81 @@
  */
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <expected>
+#include <latch>
 #include <memory>
+#include <ranges>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include <catch2/catch_test_macros.hpp>
 
 #include "block.h"
+#include "blocks_device.h"
+#include "structs.h"
 #include "utils/test_blocks_device.h"
+#include "utils/test_memory_device.h"
 
 namespace {
 auto LoadBlock(std::shared_ptr<TestBlocksDevice> device, uint32_t block_number, uint32_t data_size) {
   return Block::LoadDataBlock(std::move(device), block_number, BlockSize::Logical, BlockType::Single, data_size,
                               /*iv=*/0, Block::HashRef{}, /*encrypted=*/false, /*load_data=*/false);
 }
+
+std::shared_ptr<TestMemoryDevice> CreateMemoryDevice(uint32_t sectors_count) {
+  return std::make_shared<TestMemoryDevice>(sectors_count, /*mappable=*/false);
+}
+
+std::shared_ptr<BlocksDevice> CreateEncryptedDevice(std::shared_ptr<TestMemoryDevice> memory_device) {
+  return std::make_shared<BlocksDevice>(std::move(memory_device), std::vector<std::byte>(16, std::byte{0x5a}));
+}
+
+// An encrypted large data block at physical block 8, with its hash at the start of a detached block.
+constexpr uint32_t kLargeBlockSize = 0x10000;
+
+std::shared_ptr<Block> CreateHashBlock() {
+  return Block::CreateDetached(std::vector<std::byte>(DeviceEncryption::DIGEST_SIZE));
+}
+
+std::expected<std::shared_ptr<Block>, WfsError> TryLoadLargeBlock(std::shared_ptr<BlocksDevice> device,
+                                                                  std::shared_ptr<Block> hash_block,
+                                                                  bool load_data) {
+  return Block::LoadDataBlock(std::move(device), /*block_number=*/8, BlockSize::Logical, BlockType::Large,
+                              kLargeBlockSize, /*iv=*/8, {std::move(hash_block), 0}, /*encrypted=*/true, load_data);
+}
+
+std::shared_ptr<Block> LoadLargeBlock(std::shared_ptr<BlocksDevice> device,
+                                      std::shared_ptr<Block> hash_block,
+                                      bool load_data) {
+  auto block = TryLoadLargeBlock(std::move(device), std::move(hash_block), load_data);
+  REQUIRE(block.has_value());
+  return *block;
+}
+
+std::vector<std::byte> LargeBlockData() {
+  std::vector<std::byte> data(kLargeBlockSize);
+  std::ranges::generate(data, [i = 0]() mutable { return static_cast<std::byte>(i++ * 7); });
+  return data;
+}
+
+// Metadata blocks of a physical block, with their block number as the IV.
+std::shared_ptr<Block> LoadMetadataBlock(std::shared_ptr<BlocksDevice> device,
+                                         uint32_t block_number,
+                                         bool load_data = true) {
+  auto block = Block::LoadMetadataBlock(std::move(device), block_number, BlockSize::Physical, /*iv=*/block_number,
+                                        load_data);
+  REQUIRE(block.has_value());
+  return *block;
+}
+
+// Fills the data of the block after its header.
+void WriteMetadataBlock(std::shared_ptr<BlocksDevice> device, uint32_t block_number, std::byte value) {
+  auto block = LoadMetadataBlock(std::move(device), block_number, /*load_data=*/false);
+  std::ranges::fill(block->mutable_data() | std::views::drop(sizeof(MetadataBlockHeader)), value);
+}
 }  // namespace
 
 TEST_CASE("Block resize updates used size and zero-fills growth") {
@@ -88,3 +150,445 @@ TEST_CASE("Block resize flushes smaller aligned size") {
   REQUIRE(flushed.size() == 512);
   CHECK(std::ranges::all_of(flushed, [](std::byte value) { return value == std::byte{0x3c}; }));
 }
+
+TEST_CASE("Block uses the device view for unencrypted blocks until it is modified") {
+  auto memory_device = std::make_shared<TestMemoryDevice>(/*sectors_count=*/0x100);
+  auto device = std::make_shared<BlocksDevice>(memory_device);
+  const auto sectors = memory_device->GetSectors(/*sector_address=*/8 << 3, /*sectors_count=*/8);
+  std::ranges::fill(sectors, std::byte{0x42});
+
+  auto block_result = Block::LoadDataBlock(device, /*block_number=*/8, BlockSize::Physical, BlockType::Single,
+                                           /*data_size=*/4096, /*iv=*/0, Block::HashRef{}, /*encrypted=*/false,
+                                           /*load_data=*/true, /*check_hash=*/false);
+  REQUIRE(block_result.has_value());
+  auto block = *block_result;
+  CHECK(memory_device->reads_count == 0);
+  CHECK(block->data().data() == sectors.data());
+
+  block->mutable_data()[100] = std::byte{0x17};
+  CHECK(block->data().data() != sectors.data());
+  CHECK(sectors[100] == std::byte{0x42});
+  CHECK(block->data()[101] == std::byte{0x42});
+
+  block->Flush();
+  CHECK(sectors[100] == std::byte{0x17});
+}
+
+TEST_CASE("Block is loaded from the prefetched sectors") {
+  auto memory_device = std::make_shared<TestMemoryDevice>(/*sectors_count=*/0x100, /*mappable=*/false);
+  auto device = std::make_shared<BlocksDevice>(memory_device);
+  for (uint32_t block_number = 8; block_number < 11; ++block_number)
+    std::ranges::fill(memory_device->GetSectors(block_number << 3, 8), std::byte{static_cast<uint8_t>(block_number)});
+
+  const std::array<BlocksDevice::BlockExtent, 3> blocks{{{8, 4096}, {9, 4096}, {10, 1000}}};
+  device->PrefetchBlocks(blocks);
+  CHECK(memory_device->read_batches_count == 1);
+  const auto reads_count = memory_device->reads_count.load();
+
+  for (const auto& extent : blocks) {
+    auto block_result = Block::LoadDataBlock(device, extent.block_number, BlockSize::Physical, BlockType::Single,
+                                             extent.data_size, /*iv=*/0, Block::HashRef{}, /*encrypted=*/false,
+                                             /*load_data=*/true, /*check_hash=*/false);
+    REQUIRE(block_result.has_value());
+    CHECK((*block_result)->size() == extent.data_size);
+    CHECK(std::ranges::all_of((*block_result)->data(), [&](std::byte value) {
+      return value == std::byte{static_cast<uint8_t>(extent.block_number)};
+    }));
+  }
+  CHECK(memory_device->reads_count == reads_count);
+}
+
+TEST_CASE("Prefetched blocks are kept until they are read, up to a batch size") {
+  constexpr uint32_t kBatchBlocks = BlocksDevice::kMaxPrefetchBytes >> log2_size(BlockSize::Physical);
+  auto memory_device = std::make_shared<TestMemoryDevice>(/*sectors_count=*/(kBatchBlocks + 0x40) << 3,
+                                                          /*mappable=*/false);
+  auto device = std::make_shared<BlocksDevice>(memory_device);
+  auto load_block = [&](uint32_t block_number) {
+    return *Block::LoadDataBlock(device, block_number, BlockSize::Physical, BlockType::Single, /*data_size=*/4096,
+                                 /*iv=*/0, Block::HashRef{}, /*encrypted=*/false, /*load_data=*/true,
+                                 /*check_hash=*/false);
+  };
+
+  // A second batch, like the one of another file, doesn't drop the blocks of the first one.
+  const std::array<BlocksDevice::BlockExtent, 2> first{{{8, 4096}, {9, 4096}}};
+  const std::array<BlocksDevice::BlockExtent, 2> second{{{16, 4096}, {17, 4096}}};
+  device->PrefetchBlocks(first);
+  device->PrefetchBlocks(second);
+  auto reads_count = memory_device->reads_count.load();
+  load_block(8);
+  load_block(16);
+  CHECK(memory_device->reads_count == reads_count);
+
+  // The blocks beyond the batch size aren't read.
+  std::vector<BlocksDevice::BlockExtent> blocks;
+  for (uint32_t block_number = 0x20; block_number <= kBatchBlocks + 0x20; ++block_number)
+    blocks.push_back({block_number, 4096});
+  device->PrefetchBlocks(blocks);
+  reads_count = memory_device->reads_count.load();
+  load_block(0x20);
+  load_block(kBatchBlocks + 0x1f);
+  CHECK(memory_device->reads_count == reads_count);
+  load_block(kBatchBlocks + 0x20);
+  CHECK(memory_device->reads_count == reads_count + 1);
+}
+
+TEST_CASE("Blocks fetched together read contiguous blocks at once") {
+  auto memory_device = CreateMemoryDevice(/*sectors_count=*/0x100);
+  const std::array<uint32_t, 4> block_numbers{10, 20, 8, 9};
+  {
+    auto device = CreateEncryptedDevice(memory_device);
+    for (auto block_number : block_numbers) {
+      auto block = *Block::LoadMetadataBlock(device, block_number, BlockSize::Physical, /*iv=*/block_number * 3,
+                                             /*load_data=*/false);
+      std::ranges::fill(block->mutable_data(), std::byte{static_cast<uint8_t>(block_number)});
+    }
+  }
+  const auto writes_count = memory_device->writes_count.load();
+  CHECK(writes_count == block_numbers.size());
+
+  auto device = CreateEncryptedDevice(memory_device);
+  std::vector<std::shared_ptr<Block>> blocks;
+  for (auto block_number : block_numbers) {
+    blocks.push_back(*Block::LoadMetadataBlock(device, block_number, BlockSize::Physical, /*iv=*/block_number * 3,
+                                               /*load_data=*/false));
+  }
+  REQUIRE(Block::FetchBlocks(blocks));
+  // Blocks 8-10 are one range, block 20 another.
+  CHECK(memory_device->reads_count == 2);
+  for (const auto& block : blocks) {
+    // Skip the hash
+    CHECK(std::ranges::all_of(block->data().subspan(sizeof(MetadataBlockHeader)), [&](std::byte value) {
+      return value == std::byte{static_cast<uint8_t>(block->physical_block_number())};
+    }));
+  }
+  CHECK(memory_device->writes_count == writes_count);
+
+  // Corrupt block 9 and refetch.
+  blocks.clear();
+  memory_device->GetSectors(9 << 3, 1)[100] ^= std::byte{1};
+  for (auto block_number : block_numbers) {
+    blocks.push_back(*Block::LoadMetadataBlock(device, block_number, BlockSize::Physical, /*iv=*/block_number * 3,
+                                               /*load_data=*/false));
+  }
+  CHECK_FALSE(Block::FetchBlocks(blocks));
+}
+
+TEST_CASE("Block buffers are aligned for direct I/O") {
+  auto device = std::make_shared<TestBlocksDevice>();
+  auto block_result = LoadBlock(device, /*block_number=*/3, /*data_size=*/1000);
+  REQUIRE(block_result.has_value());
+  auto block = *block_result;
+  CHECK(IsDirectIoAligned(block->data().data()));
+  block->Resize(3000);
+  CHECK(IsDirectIoAligned(block->data().data()));
+}
+
+TEST_CASE("Block buffers are reused from their size class") {
+  std::byte* data;
+  {
+    BlockBuffer buffer(3000);
+    data = buffer.data();
+    CHECK(IsDirectIoAligned(data));
+  }
+  // Any size of the same class gets the buffer that was just freed.
+  BlockBuffer buffer(4096);
+  CHECK(buffer.data() == data);
+  BlockBuffer large_buffer(0x80000);
+  CHECK(IsDirectIoAligned(large_buffer.data()));
+}
+
+TEST_CASE("Sequential block reads are read ahead") {
+  auto memory_device = std::make_shared<TestMemoryDevice>(/*sectors_count=*/0x100, /*mappable=*/false);
+  for (uint32_t block_number = 0; block_number < 0x20; ++block_number)
+    std::ranges::fill(memory_device->GetSectors(block_number << 3, 8), std::byte{static_cast<uint8_t>(block_number)});
+  auto device = std::make_shared<BlocksDevice>(memory_device);
+  device->SetReadAheadWindow(8);
+
+  std::vector<std::byte> data(0x1000);
+  auto read_block = [&](uint32_t block_number) {
+    REQUIRE(device->ReadBlock(block_number, 1, data, {}, /*iv=*/0, /*encrypt=*/false, /*check_hash=*/false));
+    CHECK(std::ranges::all_of(
+        data, [&](std::byte value) { return value == std::byte{static_cast<uint8_t>(block_number)}; }));
+  };
+  for (uint32_t block_number = 0; block_number < 11; ++block_number)
+    read_block(block_number);
+
+  // A write drops the window it overlaps.
+  std::ranges::fill(data, std::byte{0x77});
+  std::array<std::byte, DeviceEncryption::DIGEST_SIZE> hash;
+  device->WriteBlock(12, 1, data, hash, /*iv=*/0, /*encrypt=*/false, /*recalculate_hash=*/false);
+  REQUIRE(device->ReadBlock(12, 1, data, {}, /*iv=*/0, /*encrypt=*/false, /*check_hash=*/false));
+  CHECK(data[0] == std::byte{0x77});
+
+  // Waits for the reads in flight.
+  device->SetReadAheadWindow(0);
+  // Blocks 0-1 are read one by one, then the windows of blocks 2-9, 10-17 and 18-25 are read ahead, and block 12 is
+  // read again after the write.
+  CHECK(memory_device->reads_count == 6);
+
+  // Random access doesn't read ahead.
+  device->SetReadAheadWindow(8);
+  read_block(30);
+  read_block(20);
+  read_block(25);
+  device->SetReadAheadWindow(0);
+  CHECK(memory_device->reads_count == 9);
+}
+
+TEST_CASE("FlushAll writes contiguous dirty blocks at once") {
+  auto memory_device = CreateMemoryDevice(/*sectors_count=*/0x100);
+  constexpr size_t kFirstHashOffset = 0x100;
+  auto load_blocks = [&](const std::shared_ptr<BlocksDevice>& device, bool load_data) {
+    std::vector<std::shared_ptr<Block>> blocks;
+    blocks.push_back(LoadMetadataBlock(device, /*block_number=*/8, load_data));
+    for (uint32_t block_number : {9, 10, 20}) {
+      auto data_block = Block::LoadDataBlock(
+          device, block_number, BlockSize::Physical, BlockType::Single, /*data_size=*/4096, /*iv=*/block_number,
+          {blocks.front(), kFirstHashOffset + (block_number - 9) * DeviceEncryption::DIGEST_SIZE}, /*encrypted=*/true,
+          load_data);
+      REQUIRE(data_block.has_value());
+      blocks.push_back(*data_block);
+    }
+    return blocks;
+  };
+  {
+    auto device = CreateEncryptedDevice(memory_device);
+    auto blocks = load_blocks(device, /*load_data=*/false);
+    for (const auto& block : blocks | std::views::drop(1))
+      std::ranges::fill(block->mutable_data(), std::byte{static_cast<uint8_t>(block->physical_block_number())});
+    device->FlushAll();
+    // Blocks 8-10 are one range, block 20 another.
+    CHECK(memory_device->writes_count == 2);
+  }
+  // Nothing was dirty anymore when the blocks were released.
+  CHECK(memory_device->writes_count == 2);
+
+  // The metadata block was written with the hashes of the data blocks.
+  auto device = CreateEncryptedDevice(memory_device);
+  auto blocks = load_blocks(device, /*load_data=*/true);
+  for (const auto& block : blocks | std::views::drop(1))
+    CHECK(block->data()[0] == std::byte{static_cast<uint8_t>(block->physical_block_number())});
+}
+
+TEST_CASE("FlushAll only writes the blocks that were modified since the last flush") {
+  auto memory_device = std::make_shared<TestMemoryDevice>(/*sectors_count=*/0x100, /*mappable=*/false);
+  auto device = std::make_shared<BlocksDevice>(memory_device);
+  std::vector<std::shared_ptr<Block>> blocks;
+  for (uint32_t block_number = 8; block_number < 16; block_number += 2) {
+    auto block = Block::LoadMetadataBlock(device, block_number, BlockSize::Physical, /*iv=*/0, /*load_data=*/false);
+    REQUIRE(block.has_value());
+    blocks.push_back(*block);
+  }
+  device->FlushAll();
+  CHECK(memory_device->writes_count == 0);
+
+  blocks[1]->mutable_data()[0x100] = std::byte{1};
+  blocks[2]->Resize(0x800);
+  device->FlushAll();
+  CHECK(memory_device->writes_count == 2);
+  device->FlushAll();
+  CHECK(memory_device->writes_count == 2);
+
+  // Detached blocks are not flushed.
+  blocks[3]->mutable_data()[0x100] = std::byte{1};
+  blocks[3]->Detach();
+  device->FlushAll();
+  CHECK(memory_device->writes_count == 2);
+}
+
+TEST_CASE("Flushing a modified block only writes from its first modified sector") {
+  auto memory_device = CreateMemoryDevice(/*sectors_count=*/0x200);
+  auto hash_block = CreateHashBlock();
+  auto expected = LargeBlockData();
+
+  {
+    auto device = CreateEncryptedDevice(memory_device);
+    // A new block is written whole.
+    auto block = LoadLargeBlock(device, hash_block, /*load_data=*/false);
+    std::ranges::copy(expected, block->mutable_data().begin());
+    block->Flush();
+    CHECK(memory_device->written_bytes == kLargeBlockSize);
+
+    // Then only from the sector of the first modified byte, twice in the batched flush.
+    std::ranges::fill(block->mutable_data(0xC010, 0x10), std::byte{0x11});
+    std::ranges::fill(expected.begin() + 0xC010, expected.begin() + 0xC020, std::byte{0x11});
+    block->Flush();
+    CHECK(memory_device->written_bytes == kLargeBlockSize + 0x4000);
+    std::ranges::fill(block->mutable_data(0xF200, 0x10), std::byte{0x22});
+    std::ranges::fill(expected.begin() + 0xF200, expected.begin() + 0xF210, std::byte{0x22});
+    device->FlushAll();
+    CHECK(memory_device->written_bytes == kLargeBlockSize + 0x4000 + 0xE00);
+  }
+
+  // The partial writes are chained to the rest of the block, which still matches its hash.
+  auto block = LoadLargeBlock(CreateEncryptedDevice(memory_device), hash_block, /*load_data=*/true);
+  CHECK(std::ranges::equal(block->data(), expected));
+}
+
+TEST_CASE("Reading a range of a block only reads the sectors of the range") {
+  auto memory_device = CreateMemoryDevice(/*sectors_count=*/0x200);
+  auto hash_block = CreateHashBlock();
+  auto expected = LargeBlockData();
+  {
+    auto block = LoadLargeBlock(CreateEncryptedDevice(memory_device), hash_block, /*load_data=*/false);
+    std::ranges::copy(expected, block->mutable_data().begin());
+  }
+
+  auto device = CreateEncryptedDevice(memory_device);
+  auto read_range = [&](size_t offset, size_t size) {
+    std::vector<std::byte> data(size);
+    auto const read_bytes = memory_device->read_bytes.load();
+    CHECK(Block::ReadDataBlockRange(device, /*physical_block_number=*/8, kLargeBlockSize, /*iv=*/8, /*encrypted=*/true,
+                                    offset, data) == false);
+    CHECK(std::ranges::equal(data, std::span{expected}.subspan(offset, size)));
+    return memory_device->read_bytes - read_bytes;
+  };
+  CHECK(read_range(0, 0x10) == 0x200);
+  // The sectors of the range, and the one before them that they are chained to.
+  CHECK(read_range(0x4321, 0x100) == 0x600);
+  CHECK(read_range(kLargeBlockSize - 0x10, 0x10) == 0x400);
+
+  // A loaded block is used as is, with its changes.
+  auto block = LoadLargeBlock(device, hash_block, /*load_data=*/true);
+  std::ranges::fill(block->mutable_data(0x4321, 4), std::byte{0x33});
+  std::array<std::byte, 4> data;
+  CHECK(Block::ReadDataBlockRange(device, /*physical_block_number=*/8, kLargeBlockSize, /*iv=*/8, /*encrypted=*/true,
+                                  0x4321, data) == true);
+  CHECK(std::ranges::all_of(data, [](std::byte b) { return b == std::byte{0x33}; }));
+}
+
+TEST_CASE("Blocks that were verified aren't hashed again until they are written") {
+  auto memory_device = CreateMemoryDevice(/*sectors_count=*/0x200);
+  auto device = CreateEncryptedDevice(memory_device);
+  auto hash_block = CreateHashBlock();
+  auto load_block = [&](bool load_data) { return TryLoadLargeBlock(device, hash_block, load_data); };
+  auto write_block = [&](std::byte value) {
+    std::ranges::fill(LoadLargeBlock(device, hash_block, /*load_data=*/false)->mutable_data(), value);
+  };
+  // Changes the last sector of the block behind the back of the blocks device, so it is only noticed if the block is
+  // hashed.
+  auto corrupt_block = [&]() {
+    memory_device->GetSectors(8 * 8 + kLargeBlockSize / 512 - 1, 1).back() ^= std::byte{1};
+  };
+
+  write_block(std::byte{0x11});
+  corrupt_block();
+  CHECK(!load_block(/*load_data=*/true).has_value());
+
+  device->SetVerifiedBlocksCapacity(16);
+  write_block(std::byte{0x22});
+  CHECK(load_block(/*load_data=*/true).has_value());
+  corrupt_block();
+  CHECK(load_block(/*load_data=*/true).has_value());
+
+  // Writing the block forgets that it was verified.
+  write_block(std::byte{0x33});
+  corrupt_block();
+  CHECK(!load_block(/*load_data=*/true).has_value());
+}
+
+TEST_CASE("Released clean blocks are retained within the budget") {
+  auto memory_device = CreateMemoryDevice(/*sectors_count=*/0x100);
+  auto device = CreateEncryptedDevice(memory_device);
+  device->SetRetainedCacheBudget(4 * 4096);
+  auto write_block = [&](uint32_t block_number) {
+    WriteMetadataBlock(device, block_number, std::byte{static_cast<uint8_t>(block_number)});
+  };
+  auto check_block = [&](uint32_t block_number) {
+    CHECK(LoadMetadataBlock(device, block_number)->data().back() == std::byte{static_cast<uint8_t>(block_number)});
+  };
+
+  write_block(8);
+  CHECK(device->RetainedCacheSize() == 4096);
+  check_block(8);
+  CHECK(memory_device->reads_count == 0);
+
+  // A scan over blocks that are used once doesn't evict a block that was used again.
+  for (uint32_t block_number = 16; block_number < 24; ++block_number)
+    write_block(block_number);
+  CHECK(device->RetainedCacheSize() <= 4 * 4096);
+  check_block(8);
+  CHECK(memory_device->reads_count == 0);
+  check_block(16);
+  CHECK(memory_device->reads_count == 1);
+
+  // Writing a block drops its retained data.
+  check_block(23);
+  CHECK(memory_device->reads_count == 1);
+  std::vector<std::byte> data(4096, std::byte{0x77});
+  device->WriteBlock(23, 1, data, std::span{data}.subspan(offsetof(MetadataBlockHeader, hash), 20), /*iv=*/23,
+                     /*encrypt=*/true, /*recalculate_hash=*/true);
+  auto block = LoadMetadataBlock(device, 23);
+  CHECK(memory_device->reads_count == 2);
+  CHECK(block->data().back() == std::byte{0x77});
+}
+
+TEST_CASE("Blocks loaded concurrently are read once") {
+  constexpr uint32_t kFirstBlock = 8;
+  constexpr uint32_t kBlocksCount = 16;
+  constexpr size_t kThreadsCount = 8;
+  auto memory_device = CreateMemoryDevice(/*sectors_count=*/0x100);
+  {
+    auto device = CreateEncryptedDevice(memory_device);
+    for (uint32_t block_number = kFirstBlock; block_number < kFirstBlock + kBlocksCount; ++block_number)
+      WriteMetadataBlock(device, block_number, std::byte{static_cast<uint8_t>(block_number)});
+  }
+  const auto reads_count = memory_device->reads_count.load();
+
+  auto device = CreateEncryptedDevice(memory_device);
+  std::latch done(kThreadsCount);
+  std::vector<std::vector<std::shared_ptr<Block>>> loaded_blocks(kThreadsCount);
+  std::vector<std::jthread> threads;
+  for (size_t thread = 0; thread < kThreadsCount; ++thread) {
+    threads.emplace_back([&, thread] {
+      // Each thread loads all the blocks, starting at a different block, and holds them until all of them are done.
+      for (uint32_t i = 0; i < kBlocksCount; ++i) {
+        auto const block_number = kFirstBlock + static_cast<uint32_t>((i + thread) % kBlocksCount);
+        auto block = Block::LoadMetadataBlock(device, block_number, BlockSize::Physical, /*iv=*/block_number);
+        if (block)
+          loaded_blocks[thread].push_back(std::move(*block));
+      }
+      done.arrive_and_wait();
+    });
+  }
+  threads.clear();
+
+  for (const auto& blocks : loaded_blocks) {
+    REQUIRE(blocks.size() == kBlocksCount);
+    for (const auto& block : blocks)
+      CHECK(block->data().back() == std::byte{static_cast<uint8_t>(block->physical_block_number())});
+  }
+  CHECK(memory_device->reads_count == reads_count + kBlocksCount);
+}
+
+TEST_CASE("Released dirty blocks are written in the background") {
+  auto memory_device = CreateMemoryDevice(/*sectors_count=*/0x100);
+  auto device = CreateEncryptedDevice(memory_device);
+  auto check_block = [&](uint32_t block_number, std::byte value) {
+    CHECK(LoadMetadataBlock(device, block_number)->data().back() == value);
+  };
+
+  device->StartWriteback({.max_age = std::chrono::hours(1), .background_bytes = 1 << 20, .limit_bytes = 1 << 20});
+  WriteMetadataBlock(device, 8, std::byte{1});
+  WriteMetadataBlock(device, 9, std::byte{2});
+  CHECK(memory_device->writes_count == 0);
+  // Loaded from the pending write.
+  check_block(8, std::byte{1});
+  CHECK(memory_device->reads_count == 0);
+
+  // A newer write replaces the pending one.
+  WriteMetadataBlock(device, 9, std::byte{3});
+  device->FlushAll();
+  CHECK(memory_device->writes_count == 1);
+  check_block(9, std::byte{3});
+  CHECK(memory_device->reads_count == 1);
+
+  // Old enough writes are written by the thread.
+  device->StartWriteback({.max_age = {}, .background_bytes = 1 << 20, .limit_bytes = 1 << 20});
+  WriteMetadataBlock(device, 10, std::byte{4});
+  for (int i = 0; i < 1000 && memory_device->writes_count < 2; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  CHECK(memory_device->writes_count == 2);
+  device->StopWriteback();
+  check_block(10, std::byte{4});
+}
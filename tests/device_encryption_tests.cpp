@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include "device_encryption.h"
+#include "sha1.h"
+#include "thread_pool.h"
+#include "utils/test_memory_device.h"
+
+namespace {
+std::vector<std::byte> RandomData(size_t size) {
+  std::mt19937 rng(static_cast<uint32_t>(size));
+  std::vector<std::byte> data(size);
+  std::ranges::generate(data, [&] { return static_cast<std::byte>(rng()); });
+  return data;
+}
+}  // namespace
+
+TEST_CASE("Large blocks decrypted in parallel chunks match the serial encryption") {
+  auto device = std::make_shared<TestMemoryDevice>(/*sectors_count=*/0x10000);
+  DeviceEncryption encryption(device, std::vector<std::byte>(16, std::byte{0x42}));
+
+  for (size_t size : {size_t{0x1000}, 2 * DeviceEncryption::kParallelDecryptChunkSize + 0x200, size_t{0x80000}}) {
+    auto const plain = RandomData(size);
+    auto data = plain;
+    encryption.EncryptBlock(data, /*iv=*/0x1234);
+    CHECK(data != plain);
+    encryption.DecryptBlock(data, /*iv=*/0x1234);
+    CHECK(data == plain);
+  }
+}
+
+TEST_CASE("Interleaved encryption of several blocks matches encrypting each block") {
+  auto device = std::make_shared<TestMemoryDevice>(/*sectors_count=*/0x10000);
+  DeviceEncryption encryption(device, std::vector<std::byte>(16, std::byte{0x42}));
+
+  // More blocks than lanes, with different sizes so lanes are refilled at different times.
+  std::vector<std::vector<std::byte>> blocks;
+  for (size_t i = 0; i < 20; ++i)
+    blocks.push_back(RandomData((i % 5) * 0x1000 + 0x200));
+  auto expected = blocks;
+  std::vector<DeviceEncryption::BlockRef> refs;
+  for (uint32_t i = 0; i < blocks.size(); ++i) {
+    encryption.EncryptBlock(expected[i], /*iv=*/i * 0x10);
+    refs.push_back({blocks[i], /*iv=*/i * 0x10, /*previous_cipher_block=*/nullptr});
+  }
+  encryption.EncryptBlocks(refs);
+  CHECK(blocks == expected);
+}
+
+TEST_CASE("Decrypting with the hash check matches decrypting and then checking") {
+  auto device = std::make_shared<TestMemoryDevice>(/*sectors_count=*/0x10000);
+  DeviceEncryption encryption(device, std::vector<std::byte>(16, std::byte{0x42}));
+
+  // Serial and parallel sizes, with the hash in the block (as in metadata blocks) and outside of it.
+  for (size_t size : {size_t{0x1000}, size_t{0x6200}, size_t{0x80000}}) {
+    for (bool hash_in_block : {false, true}) {
+      auto plain = RandomData(size);
+      std::array<std::byte, DeviceEncryption::DIGEST_SIZE> external_hash;
+      std::span<std::byte> hash = hash_in_block ? std::span{plain}.subspan(0x10, DeviceEncryption::DIGEST_SIZE)
+                                                : std::span<std::byte>{external_hash};
+      DeviceEncryption::CalculateHash(plain, hash);
+      auto data = plain;
+      encryption.EncryptBlock(data, /*iv=*/0x55);
+      auto corrupted = data;
+      corrupted.back() ^= std::byte{1};
+
+      std::span<const std::byte> data_hash =
+          hash_in_block ? std::span{data}.subspan(0x10, DeviceEncryption::DIGEST_SIZE) : hash;
+      CHECK(encryption.DecryptBlockAndCheckHash(data, /*iv=*/0x55, data_hash));
+      CHECK(data == plain);
+      std::span<const std::byte> corrupted_hash =
+          hash_in_block ? std::span{corrupted}.subspan(0x10, DeviceEncryption::DIGEST_SIZE) : hash;
+      CHECK_FALSE(encryption.DecryptBlockAndCheckHash(corrupted, /*iv=*/0x55, corrupted_hash));
+    }
+  }
+}
+
+TEST_CASE("Every supported SHA-1 kernel matches the single block hash") {
+  // Sizes around the padding boundaries, and hashes stored in the blocks at different offsets.
+  std::vector<std::vector<std::byte>> blocks;
+  std::vector<size_t> placeholders;
+  constexpr size_t kSizes[] = {0, 1, 55, 56, 63, 64, 119, 120, 0x200, 0x1000, 0x2000};
+  for (size_t size : kSizes) {
+    blocks.push_back(RandomData(size + 3));
+    blocks.back().resize(size);
+    placeholders.push_back(size >= 0x200 ? (size / 7) & ~size_t{3} : Sha1::kNoPlaceholder);
+  }
+  std::vector<std::array<std::byte, Sha1::DIGEST_SIZE>> expected(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i)
+    Sha1::Hash({blocks[i], placeholders[i], expected[i]});
+  // SHA-1("") to check the reference itself.
+  CHECK(expected[0][0] == std::byte{0xda});
+  CHECK(expected[0][19] == std::byte{0x09});
+
+  for (auto kernel : Sha1::SupportedKernels()) {
+    std::vector<std::array<std::byte, Sha1::DIGEST_SIZE>> digests(blocks.size());
+    std::vector<Sha1::BlockHash> requests;
+    for (size_t i = 0; i < blocks.size(); ++i)
+      requests.push_back({blocks[i], placeholders[i], digests[i]});
+    Sha1::HashBlocks(requests, kernel);
+    CHECK(digests == expected);
+  }
+}
+
+TEST_CASE("Batched hash checks match the single block checks") {
+  std::vector<std::vector<std::byte>> blocks;
+  for (size_t i = 0; i < 10; ++i)
+    blocks.push_back(RandomData(0x200 * (i + 1)));
+  std::vector<std::span<const std::byte>> data;
+  std::vector<std::span<const std::byte>> hashes;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    // The hash is in the block, at its start.
+    std::span<std::byte> hash{blocks[i].data(), DeviceEncryption::DIGEST_SIZE};
+    DeviceEncryption::CalculateHash(blocks[i], hash);
+    CHECK(DeviceEncryption::CheckHash(blocks[i], hash));
+    // Corrupt every third block.
+    if (i % 3 == 0)
+      blocks[i].back() ^= std::byte{1};
+    data.push_back(blocks[i]);
+    hashes.push_back(hash);
+  }
+  auto results = DeviceEncryption::CheckHashes(data, hashes);
+  REQUIRE(results.size() == blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i)
+    CHECK(results[i] == (i % 3 != 0));
+}
+
+TEST_CASE("ThreadPool runs every task once and rethrows failures") {
+  ThreadPool pool(/*threads_count=*/3);
+  std::vector<std::atomic<int>> runs(100);
+  pool.ParallelFor(runs.size(), [&](size_t i) { ++runs[i]; });
+  CHECK(std::ranges::all_of(runs, [](const auto& count) { return count == 1; }));
+
+  CHECK_THROWS_AS(pool.ParallelFor(10,
+                                   [](size_t i) {
+                                     if (i == 7)
+                                       throw std::runtime_error("failed");
+                                   }),
+                  std::runtime_error);
+}
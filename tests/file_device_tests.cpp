@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+
+#include <wfslib/blocks_device.h>
+#include <wfslib/file_device.h>
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "utils/temp_file.h"
+
+namespace {
+std::vector<std::byte> Filled(size_t size, uint8_t value) {
+  return std::vector<std::byte>(size, std::byte{value});
+}
+
+// Round-trips out of order, partly adjacent ranges through a device of 0x20 sectors.
+void CheckSectorBatches(FileDevice& device) {
+  const size_t sector_size = device.SectorSize();
+  auto first = Filled(2 * sector_size, 0x11);
+  auto second = Filled(sector_size, 0x22);
+  auto third = Filled(3 * sector_size, 0x33);
+  const std::array<Device::SectorsRange, 3> writes{{{third, 10}, {first, 4}, {second, 6}}};
+  device.WriteSectorsBatch(writes);
+
+  auto read_first = Filled(2 * sector_size, 0);
+  auto read_second = Filled(sector_size, 0);
+  auto read_third = Filled(3 * sector_size, 0);
+  const std::array<Device::SectorsRange, 3> reads{{{read_second, 6}, {read_third, 10}, {read_first, 4}}};
+  device.ReadSectorsBatch(reads);
+  CHECK(read_first == first);
+  CHECK(read_second == second);
+  CHECK(read_third == third);
+
+  // The batch is the same as the single sector calls.
+  auto single = Filled(sector_size, 0);
+  device.ReadSectors(single, /*sector_address=*/6, /*sectors_count=*/1);
+  CHECK(single == Filled(sector_size, 0x22));
+
+  auto out_of_file = Filled(2 * sector_size, 0);
+  const std::array<Device::SectorsRange, 1> bad_read{{{out_of_file, 0x1f}}};
+  CHECK_THROWS_AS(device.ReadSectorsBatch(bad_read), std::runtime_error);
+}
+}  // namespace
+
+TEST_CASE("FileDevice transfers sector batches", "[file-device]") {
+  const auto io_mode = GENERATE(FileDevice::IoMode::Stream, FileDevice::IoMode::Positional);
+  TempFile image("wfslib_file_device_batch_test.img");
+  FileDevice device(image.path(), /*log2_sector_size=*/9, /*sectors_count=*/0x20, /*read_only=*/false,
+                    /*open_create=*/true, io_mode);
+  device.SetSectorsCount(0x20);
+  CheckSectorBatches(device);
+}
+
+TEST_CASE("FileDevice transfers sector batches with direct I/O", "[file-device]") {
+  TempFile image("wfslib_file_device_direct_batch_test.img");
+  // 4K sectors, so the transfers are aligned to the logical block size of any host file system.
+  std::unique_ptr<FileDevice> device;
+  try {
+    device = std::make_unique<FileDevice>(image.path(), /*log2_sector_size=*/12, /*sectors_count=*/0x20,
+                                          /*read_only=*/false, /*open_create=*/true, FileDevice::IoMode::Direct);
+  } catch (const std::runtime_error&) {
+    // Some file systems (tmpfs for one) can't be opened for direct I/O.
+    SKIP("Direct I/O is not supported in the temp directory");
+  }
+  device->SetSectorsCount(0x20);
+  CheckSectorBatches(*device);
+}
+
+TEST_CASE("FileDevice reports the holes of a sparse image", "[file-device]") {
+  TempFile image("wfslib_file_device_holes_test.img");
+  FileDevice device(image.path(), /*log2_sector_size=*/9, /*sectors_count=*/0x10000, /*read_only=*/false,
+                    /*open_create=*/true, FileDevice::IoMode::Positional);
+  device.SetSectorsCount(0x10000);
+  auto data = Filled(0x1000, 0x42);
+  device.WriteSectors(data, /*sector_address=*/0, /*sectors_count=*/8);
+  device.WriteSectors(data, /*sector_address=*/0x8000, /*sectors_count=*/8);
+
+  auto extents = device.DataExtents(/*sector_address=*/0, /*sectors_count=*/0x10000);
+  REQUIRE_FALSE(extents.empty());
+  auto is_data = [&](uint32_t sector) {
+    return std::ranges::any_of(extents, [sector](const Device::SectorsExtent& extent) {
+      return sector >= extent.sector_address && sector < extent.sector_address + extent.sectors_count;
+    });
+  };
+  // Written sectors are always reported, holes are only reported if the host file system supports it.
+  CHECK(is_data(0));
+  CHECK(is_data(7));
+  CHECK(is_data(0x8000));
+  CHECK(is_data(0x8007));
+  if (extents.size() > 1)
+    CHECK_FALSE(is_data(0x4000));
+
+  // Reading blocks that are in a hole gives zeros.
+  BlocksDevice blocks_device(std::make_shared<FileDevice>(image.path(), /*log2_sector_size=*/9,
+                                                          /*sectors_count=*/0x10000, /*read_only=*/true,
+                                                          /*open_create=*/false, FileDevice::IoMode::Positional));
+  auto hole = Filled(0x1000, 0xff);
+  auto written = Filled(0x1000, 0);
+  const std::array<BlocksDevice::BlockRead, 2> reads{{
+      {/*block_number=*/0x800, hole, {}, /*iv=*/0, /*encrypt=*/false, /*check_hash=*/false},
+      {/*block_number=*/0x1000, written, {}, /*iv=*/0, /*encrypt=*/false, /*check_hash=*/false},
+  }};
+  blocks_device.ReadBlocks(reads);
+  CHECK(hole == Filled(0x1000, 0));
+  CHECK(written == data);
+}
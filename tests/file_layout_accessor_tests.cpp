@@ -18,7 +18,9 @@
 #include <string_view>
 #include <vector>
 
+#include <wfslib/blocks_device.h>
 #include <wfslib/device.h>
+#include <wfslib/errors.h>
 #include <wfslib/file.h>
 #include <wfslib/wfs_device.h>
 
@@ -30,6 +32,7 @@
 #include "utils.h"
 
 #include "utils/test_fixtures.h"
+#include "utils/test_memory_device.h"
 
 namespace {
 constexpr std::string_view kTestFilename = "file";
@@ -45,13 +48,18 @@ struct TestFile {
 
 class FileLayoutAccessorFixture : public MetadataBlockFixture {
  public:
-  std::shared_ptr<WfsDevice> wfs_device = *WfsDevice::Create(test_device);
+  // Uses test_device, unless another device is given. StoreDataBlock only works with test_device.
+  explicit FileLayoutAccessorFixture(std::shared_ptr<BlocksDevice> device = nullptr)
+      : blocks_device(device ? std::move(device) : test_device) {
+    directory_map->Init();
+  }
+
+  std::shared_ptr<BlocksDevice> blocks_device;
+  std::shared_ptr<WfsDevice> wfs_device = *WfsDevice::Create(blocks_device);
   std::shared_ptr<QuotaArea> quota = wfs_device->GetRootArea();
   std::shared_ptr<Block> directory_block = *quota->AllocMetadataBlock();
   std::shared_ptr<DirectoryMap> directory_map = std::make_shared<DirectoryMap>(quota, directory_block);
 
-  FileLayoutAccessorFixture() { directory_map->Init(); }
-
   TestFile CreateFile(std::string_view name, const FileLayout& layout) {
     std::vector<std::byte> metadata_storage(size_t{1} << layout.metadata_log2_size, std::byte{0});
     auto* metadata = reinterpret_cast<EntryMetadata*>(metadata_storage.data());
@@ -283,3 +291,85 @@ TEST_CASE_METHOD(FileLayoutAccessorFixture,
 
   RequireReadThenReplace(test_file.file, offset, kInitialData, kReplacementData);
 }
+
+TEST_CASE_METHOD(FileLayoutAccessorFixture,
+                 "File layout accessor reads small ranges of large blocks without loading them",
+                 "[file-layout-accessor][unit]") {
+  const auto large_block_size = static_cast<uint32_t>(quota->block_size() << log2_size(BlockType::Large));
+  constexpr std::array<uint32_t, 1> data_blocks{120};
+  auto test_file = CreateFile(kTestFilename, large_block_size);
+  REQUIRE(test_file.metadata->size_category.value() == FileLayout::CategoryValue(FileLayoutCategory::LargeBlocks));
+  SetReversedBlockList(test_file.metadata, quota->block_size_log2(), data_blocks);
+
+  std::vector<std::byte> large_block_data(large_block_size);
+  std::ranges::generate(large_block_data, [i = 0]() mutable { return static_cast<std::byte>(i++ * 7); });
+  StoreDataBlock(data_blocks[0], large_block_data);
+
+  File::file_device device(test_file.file, /*range_reads=*/true);
+  const size_t offset = 5 * quota->block_size() + 3;
+  std::array<std::byte, 16> output{};
+  device.seek(static_cast<boost::iostreams::stream_offset>(offset), std::ios_base::beg);
+  const auto output_size = static_cast<std::streamsize>(output.size());
+  REQUIRE(device.read(reinterpret_cast<char*>(output.data()), output_size) == output_size);
+  CHECK(std::ranges::equal(output, std::span{large_block_data}.subspan(offset, output.size())));
+  CHECK(test_device->block_range_reads_ == 1);
+
+  // Reading most of the block loads it.
+  std::vector<std::byte> whole_block(large_block_size);
+  device.seek(0, std::ios_base::beg);
+  const auto whole_block_size = static_cast<std::streamsize>(whole_block.size());
+  REQUIRE(device.read(reinterpret_cast<char*>(whole_block.data()), whole_block_size) == whole_block_size);
+  CHECK(whole_block == large_block_data);
+  CHECK(test_device->block_range_reads_ == 1);
+
+  CHECK_NOTHROW(device.VerifyRangeReads());
+}
+
+TEST_CASE("File layout accessor checks the hashes of the blocks that ranges were read from",
+          "[file-layout-accessor][unit]") {
+  auto memory_device = std::make_shared<TestMemoryDevice>(
+      /*sectors_count=*/10000 << (log2_size(BlockSize::Logical) - 9), /*mappable=*/false);
+  FileLayoutAccessorFixture fixture(std::make_shared<BlocksDevice>(memory_device));
+  const auto& quota = fixture.quota;
+  const auto large_block_size = static_cast<uint32_t>(quota->block_size() << log2_size(BlockType::Large));
+  constexpr std::array<uint32_t, 1> data_blocks{120};
+  auto test_file = fixture.CreateFile(kTestFilename, large_block_size);
+  SetReversedBlockList(test_file.metadata, quota->block_size_log2(), data_blocks);
+
+  std::vector<std::byte> large_block_data(large_block_size);
+  std::ranges::generate(large_block_data, [i = 0]() mutable { return static_cast<std::byte>(i++ * 7); });
+  {
+    // Written through the device, so the hash in the file metadata matches it.
+    auto* hash = AlignedMetadataItems<DataBlockMetadata>(test_file.metadata, 1)[0].hash;
+    const Block::HashRef hash_ref{test_file.metadata_block,
+                                  static_cast<size_t>(reinterpret_cast<const std::byte*>(hash) -
+                                                      test_file.metadata_block->data().data())};
+    auto block = throw_if_error(quota->LoadDataBlock(data_blocks[0], static_cast<BlockSize>(quota->block_size_log2()),
+                                                     BlockType::Large, large_block_size, hash_ref,
+                                                     /*encrypted=*/false, /*new_block=*/true));
+    std::ranges::copy(large_block_data, block->mutable_data().begin());
+    block->Flush();
+  }
+
+  const size_t offset = 5 * quota->block_size() + 3;
+  auto read_range = [&](File::file_device& device) {
+    std::array<std::byte, 16> output{};
+    device.seek(static_cast<boost::iostreams::stream_offset>(offset), std::ios_base::beg);
+    const auto output_size = static_cast<std::streamsize>(output.size());
+    REQUIRE(device.read(reinterpret_cast<char*>(output.data()), output_size) == output_size);
+    CHECK(std::ranges::equal(output, std::span{large_block_data}.subspan(offset, output.size())));
+  };
+
+  File::file_device device(test_file.file, /*range_reads=*/true);
+  read_range(device);
+  CHECK_NOTHROW(device.VerifyRangeReads());
+
+  // Corrupt the last sector of the block, which the range read doesn't cover.
+  const auto first_sector = quota->to_physical_block_number(data_blocks[0])
+                            << (log2_size(BlockSize::Physical) - memory_device->Log2SectorSize());
+  const auto last_sector = first_sector + (large_block_size >> memory_device->Log2SectorSize()) - 1;
+  memory_device->GetSectors(last_sector, 1)[0] ^= std::byte{0xff};
+
+  read_range(device);
+  CHECK_THROWS_AS(device.VerifyRangeReads(), WfsException);
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <wfslib/io_uring_device.h>
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "utils/temp_file.h"
+
+namespace {
+
+constexpr uint32_t kSectorsCount = 0x100;
+
+// Returns nullptr if io_uring isn't available on this system.
+std::unique_ptr<IoUringDevice> OpenDevice(const TempFile& image, uint32_t queue_depth) {
+  try {
+    auto device = std::make_unique<IoUringDevice>(image.path(), /*log2_sector_size=*/9, kSectorsCount,
+                                                  /*read_only=*/false, /*open_create=*/true, queue_depth);
+    device->SetSectorsCount(kSectorsCount);
+    return device;
+  } catch (const std::runtime_error& e) {
+    if (std::string_view{e.what()}.find("io_uring is not available") == std::string_view::npos)
+      throw;
+    return nullptr;
+  }
+}
+
+// Each sector is filled with a value derived from its address and the seed.
+std::vector<std::byte> SectorsData(uint32_t sector_address, uint32_t sectors_count, uint8_t seed) {
+  std::vector<std::byte> data(sectors_count * 0x200);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = std::byte{static_cast<uint8_t>(seed + sector_address + (i >> 9) + i)};
+  return data;
+}
+
+// Writes the sectors of [first_sector, first_sector + ranges_count * 2) in a batch of two sector ranges, out of
+// order, and reads them back in a different order. Returns whether the data read matches, without Catch2 assertions,
+// since they aren't thread safe.
+bool RoundTrip(IoUringDevice& device, uint32_t first_sector, uint32_t ranges_count, uint8_t seed) {
+  std::vector<uint32_t> order(ranges_count);
+  std::iota(order.begin(), order.end(), 0);
+  // Odd ranges first, then the even ones backwards.
+  std::ranges::stable_partition(order, [](uint32_t index) { return index % 2; });
+  std::ranges::reverse(order.begin() + ranges_count / 2, order.end());
+
+  std::vector<std::vector<std::byte>> written;
+  std::vector<Device::SectorsRange> writes;
+  for (auto index : order)
+    written.push_back(SectorsData(first_sector + index * 2, 2, seed));
+  for (size_t i = 0; i < order.size(); ++i)
+    writes.push_back({written[i], first_sector + order[i] * 2});
+  device.WriteSectorsBatch(writes);
+
+  std::vector<std::vector<std::byte>> read(ranges_count, std::vector<std::byte>(0x400));
+  std::vector<Device::SectorsRange> reads;
+  for (uint32_t i = 0; i < ranges_count; ++i)
+    reads.push_back({read[i], first_sector + i * 2});
+  device.ReadSectorsBatch(reads);
+  for (uint32_t i = 0; i < ranges_count; ++i) {
+    if (read[i] != SectorsData(first_sector + i * 2, 2, seed))
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_CASE("IoUringDevice round-trips out of order batches", "[io-uring-device]") {
+  TempFile image("wfslib_io_uring_device_batch_test.img");
+  // A small ring, so the batch doesn't fit in it.
+  auto device = OpenDevice(image, /*queue_depth=*/4);
+  if (!device)
+    SKIP("io_uring is not available");
+
+  CHECK(RoundTrip(*device, /*first_sector=*/0, /*ranges_count=*/0x20, /*seed=*/1));
+
+  auto out_of_file = std::vector<std::byte>(0x400);
+  const std::vector<Device::SectorsRange> bad_read{{out_of_file, kSectorsCount - 1}};
+  CHECK_THROWS_AS(device->ReadSectorsBatch(bad_read), std::runtime_error);
+}
+
+TEST_CASE("IoUringDevice serves batches of several threads together", "[io-uring-device]") {
+  TempFile image("wfslib_io_uring_device_threads_test.img");
+  auto device = OpenDevice(image, /*queue_depth=*/4);
+  if (!device)
+    SKIP("io_uring is not available");
+
+  constexpr uint32_t kThreadsCount = 4;
+  constexpr uint32_t kRangesCount = kSectorsCount / kThreadsCount / 2;
+  std::vector<std::exception_ptr> errors(kThreadsCount);
+  std::vector<uint8_t> matches(kThreadsCount, 1);
+  {
+    std::vector<std::jthread> threads;
+    for (uint32_t i = 0; i < kThreadsCount; ++i) {
+      threads.emplace_back([&, i] {
+        try {
+          for (uint8_t round = 0; round < 8; ++round) {
+            if (!RoundTrip(*device, i * kRangesCount * 2, kRangesCount, static_cast<uint8_t>(i * 8 + round)))
+              matches[i] = false;
+          }
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      });
+    }
+  }
+  for (const auto& error : errors) {
+    if (error)
+      std::rethrow_exception(error);
+  }
+  CHECK(std::ranges::all_of(matches, [](uint8_t match) { return match; }));
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <wfslib/blocks_device.h>
+#include <wfslib/mmap_device.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "block.h"
+#include "utils/temp_file.h"
+
+namespace {
+std::vector<std::byte> Filled(size_t size, uint8_t value) {
+  return std::vector<std::byte>(size, std::byte{value});
+}
+}  // namespace
+
+TEST_CASE("MmapDevice extends a new image to its sectors count", "[mmap-device]") {
+  TempFile image("wfslib_mmap_device_extend_test.img");
+  {
+    // Like WfsDevice::Create, the sectors count is only set after the device is opened.
+    MmapDevice device(image.path(), /*log2_sector_size=*/9, /*sectors_count=*/0, /*read_only=*/false,
+                      /*open_create=*/true);
+    device.SetSectorsCount(0x20);
+    CHECK(device.GetFileSize() == 0x20 * 0x200);
+
+    auto data = Filled(2 * 0x200, 0x11);
+    device.WriteSectors(data, /*sector_address=*/0x1e, /*sectors_count=*/2);
+    auto read = Filled(2 * 0x200, 0);
+    device.ReadSectors(read, /*sector_address=*/0x1e, /*sectors_count=*/2);
+    CHECK(read == data);
+
+    // Growing again keeps the data.
+    device.SetSectorsCount(0x40);
+    CHECK(device.GetFileSize() == 0x40 * 0x200);
+    CHECK(std::ranges::equal(device.SectorsView(/*sector_address=*/0x1e, /*sectors_count=*/2), data));
+    auto out_of_file = Filled(2 * 0x200, 0);
+    CHECK_THROWS_AS(device.ReadSectors(out_of_file, /*sector_address=*/0x3f, /*sectors_count=*/2),
+                    std::runtime_error);
+  }
+
+  // The writes went through to the file.
+  MmapDevice device(image.path(), /*log2_sector_size=*/9, /*sectors_count=*/0x40);
+  CHECK(std::ranges::equal(device.SectorsView(/*sector_address=*/0x1e, /*sectors_count=*/2), Filled(2 * 0x200, 0x11)));
+}
+
+TEST_CASE("MmapDevice hands unencrypted blocks views of the file", "[mmap-device]") {
+  TempFile image("wfslib_mmap_device_view_test.img");
+  auto mmap_device = std::make_shared<MmapDevice>(image.path(), /*log2_sector_size=*/9, /*sectors_count=*/0x100,
+                                                  /*read_only=*/false, /*open_create=*/true);
+  auto const sectors = mmap_device->SectorsView(/*sector_address=*/8 << 3, /*sectors_count=*/8);
+  REQUIRE(sectors.size() == 0x1000);
+  auto device = std::make_shared<BlocksDevice>(mmap_device);
+  {
+    std::vector<std::byte> data(0x1000, std::byte{0x42});
+    mmap_device->WriteSectors(data, /*sector_address=*/8 << 3, /*sectors_count=*/8);
+  }
+
+  auto block = Block::LoadDataBlock(device, /*block_number=*/8, BlockSize::Physical, BlockType::Single,
+                                    /*data_size=*/0x1000, /*iv=*/0, Block::HashRef{}, /*encrypted=*/false,
+                                    /*load_data=*/true, /*check_hash=*/false);
+  REQUIRE(block.has_value());
+  CHECK((*block)->data().data() == sectors.data());
+  CHECK((*block)->data()[0] == std::byte{0x42});
+
+  // Modified blocks get their own copy, and are written back through the mapping.
+  (*block)->mutable_data()[100] = std::byte{0x17};
+  CHECK((*block)->data().data() != sectors.data());
+  CHECK(sectors[100] == std::byte{0x42});
+  (*block)->Flush();
+  CHECK(sectors[100] == std::byte{0x17});
+  CHECK(sectors[101] == std::byte{0x42});
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <wfslib/overlay_device.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "utils/temp_file.h"
+#include "utils/test_memory_device.h"
+
+TEST_CASE("OverlayDevice keeps writes away from the base device until commit", "[overlay-device]") {
+  TempFile delta("wfslib_overlay_device_test.delta");
+  auto base = std::make_shared<TestMemoryDevice>(/*sectors_count=*/0x40);
+  for (uint32_t sector = 0; sector < 0x40; ++sector)
+    std::ranges::fill(base->GetSectors(sector, 1), std::byte{static_cast<uint8_t>(sector)});
+
+  OverlayDevice overlay(base, delta.path());
+  std::vector<std::byte> written(3 << 9, std::byte{0xee});
+  overlay.WriteSectors(written, /*sector_address=*/10, /*sectors_count=*/3);
+  CHECK(overlay.OverlaidSectorsCount() == 3);
+  CHECK(base->writes_count == 0);
+  CHECK(base->GetSectors(11, 1)[0] == std::byte{11});
+
+  // A read that spans base and overlaid sectors.
+  std::vector<std::byte> data(8 << 9);
+  overlay.ReadSectors(data, /*sector_address=*/8, /*sectors_count=*/8);
+  for (uint32_t sector = 8; sector < 16; ++sector) {
+    auto expected = sector >= 10 && sector < 13 ? std::byte{0xee} : std::byte{static_cast<uint8_t>(sector)};
+    CHECK(data[(sector - 8) << 9] == expected);
+  }
+
+  SECTION("Discard") {
+    overlay.Discard();
+    CHECK(overlay.OverlaidSectorsCount() == 0);
+    overlay.ReadSectors(data, /*sector_address=*/8, /*sectors_count=*/8);
+    CHECK(data[3 << 9] == std::byte{11});
+    CHECK(base->writes_count == 0);
+  }
+
+  SECTION("Commit") {
+    overlay.Commit();
+    CHECK(overlay.OverlaidSectorsCount() == 0);
+    CHECK(std::ranges::all_of(base->GetSectors(10, 3), [](std::byte value) { return value == std::byte{0xee}; }));
+    CHECK(base->GetSectors(13, 1)[0] == std::byte{13});
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <catch2/catch_get_random_seed.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+
+#include "ptree_node_search.h"
+
+namespace {
+
+// Keys around the interesting boundaries, including ones with the high bit set.
+constexpr std::array<key_type, 10> kKeys = {
+    0, 1, 2, 0x12345678, 0x7ffffffe, 0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff,
+};
+
+template <has_keys T>
+T MakeNode(const std::vector<key_type>& sorted_keys) {
+  T node{};
+  for (size_t i = 0; i < sorted_keys.size(); ++i)
+    node_set_key(node, i, sorted_keys[i]);
+  return node;
+}
+
+template <has_keys T>
+void CheckMatchesScalar(std::default_random_engine& rng) {
+  constexpr size_t kCapacity = node_keys_capacity<T>::value;
+  for (size_t keys_count = 0; keys_count <= kCapacity; ++keys_count) {
+    for (int round = 0; round < 100; ++round) {
+      std::vector<key_type> keys(keys_count);
+      for (auto& key : keys)
+        key = round % 2 ? kKeys[rng() % kKeys.size()] : static_cast<key_type>(rng());
+      std::ranges::sort(keys);
+      auto node = MakeNode<T>(keys);
+      // Fill the unused slots with garbage, they must be ignored.
+      for (size_t i = keys_count; i < kCapacity; ++i)
+        node_set_key(node, i, static_cast<key_type>(rng()));
+      for (auto key : kKeys) {
+        auto const expected = static_cast<size_t>(std::ranges::upper_bound(keys, key) - keys.begin());
+        REQUIRE(node_keys_upper_bound_scalar(node, keys_count, key) == expected);
+        REQUIRE(node_keys_upper_bound(node, keys_count, key) == expected);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+TEST_CASE("node_keys_upper_bound matches a binary search", "[ptree][unit]") {
+  std::default_random_engine rng{Catch::getSeed()};
+  CheckMatchesScalar<PTreeNode_details>(rng);
+  CheckMatchesScalar<RTreeLeaf_details>(rng);
+  CheckMatchesScalar<FTreeLeaf_details>(rng);
+}
+
+TEST_CASE("node_full_keys_upper_bound counts the implicit first key of parent nodes", "[ptree][unit]") {
+  auto const parent = MakeNode<PTreeNode_details>({10, 20, 0x90000000});
+  REQUIRE(node_full_keys_upper_bound(parent, 4, 0) == 1);
+  REQUIRE(node_full_keys_upper_bound(parent, 4, 10) == 2);
+  REQUIRE(node_full_keys_upper_bound(parent, 4, 0x8fffffff) == 3);
+  REQUIRE(node_full_keys_upper_bound(parent, 4, 0xffffffff) == 4);
+  REQUIRE(node_full_keys_upper_bound(parent, 0, 10) == 0);
+
+  auto const leaf = MakeNode<RTreeLeaf_details>({0, 5, 0x80000000});
+  REQUIRE(node_full_keys_upper_bound(leaf, 3, 0) == 1);
+  REQUIRE(node_full_keys_upper_bound(leaf, 3, 4) == 1);
+  REQUIRE(node_full_keys_upper_bound(leaf, 3, 0x80000000) == 3);
+  REQUIRE(node_full_keys_upper_bound(leaf, 0, 10) == 0);
+}
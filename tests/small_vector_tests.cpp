@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "small_vector.h"
+
+namespace {
+
+// Strings that are long enough to be allocated, so the sanitizers catch elements that aren't copied, moved or
+// destroyed properly.
+std::string Value(int index) {
+  return "value that doesn't fit in the small string buffer " + std::to_string(index);
+}
+
+template <size_t N>
+SmallVector<std::string, N> MakeVector(int count) {
+  SmallVector<std::string, N> vector;
+  for (int i = 0; i < count; ++i)
+    vector.push_back(Value(i));
+  return vector;
+}
+
+template <size_t N>
+void CheckValues(const SmallVector<std::string, N>& vector, int count) {
+  REQUIRE(vector.size() == static_cast<size_t>(count));
+  for (int i = 0; i < count; ++i)
+    CHECK(vector[static_cast<size_t>(i)] == Value(i));
+}
+
+template <size_t N>
+bool IsInline(const SmallVector<std::string, N>& vector) {
+  auto const* data = reinterpret_cast<const std::byte*>(vector.data());
+  auto const* object = reinterpret_cast<const std::byte*>(&vector);
+  return data >= object && data < object + sizeof(vector);
+}
+
+}  // namespace
+
+TEST_CASE("SmallVector keeps elements inline until it grows beyond its capacity", "[small-vector][unit]") {
+  SmallVector<std::string, 4> vector;
+  CHECK(vector.empty());
+  CHECK(vector.capacity() == 4);
+  for (int i = 0; i < 4; ++i)
+    vector.push_back(Value(i));
+  CHECK(IsInline(vector));
+  CHECK(vector.capacity() == 4);
+
+  vector.push_back(Value(4));
+  CHECK_FALSE(IsInline(vector));
+  CHECK(vector.capacity() >= 5);
+  CheckValues(vector, 5);
+  CHECK(vector.front() == Value(0));
+  CHECK(vector.back() == Value(4));
+
+  vector.pop_back();
+  CheckValues(vector, 4);
+  vector.clear();
+  CHECK(vector.empty());
+  // The heap storage is kept.
+  CHECK_FALSE(IsInline(vector));
+}
+
+TEST_CASE("SmallVector reserve moves the elements to the heap", "[small-vector][unit]") {
+  auto vector = MakeVector<4>(3);
+  vector.reserve(2);
+  CHECK(IsInline(vector));
+  vector.reserve(16);
+  CHECK_FALSE(IsInline(vector));
+  CHECK(vector.capacity() == 16);
+  CheckValues(vector, 3);
+}
+
+TEST_CASE("SmallVector copies and moves inline elements", "[small-vector][unit]") {
+  auto vector = MakeVector<4>(3);
+
+  SmallVector<std::string, 4> copy(vector);
+  CHECK(IsInline(copy));
+  CheckValues(copy, 3);
+  CheckValues(vector, 3);
+
+  SmallVector<std::string, 4> moved(std::move(copy));
+  CHECK(IsInline(moved));
+  CheckValues(moved, 3);
+  CHECK(copy.empty());
+
+  SmallVector<std::string, 4> assigned = MakeVector<4>(1);
+  assigned = vector;
+  CheckValues(assigned, 3);
+
+  SmallVector<std::string, 4> move_assigned = MakeVector<4>(2);
+  move_assigned = std::move(assigned);
+  CheckValues(move_assigned, 3);
+  CHECK(assigned.empty());
+}
+
+TEST_CASE("SmallVector copies and moves heap elements", "[small-vector][unit]") {
+  auto vector = MakeVector<2>(5);
+  REQUIRE_FALSE(IsInline(vector));
+
+  SmallVector<std::string, 2> copy(vector);
+  CHECK_FALSE(IsInline(copy));
+  CHECK(copy.data() != vector.data());
+  CheckValues(copy, 5);
+  CheckValues(vector, 5);
+
+  // The heap storage is taken as is.
+  auto const* data = copy.data();
+  SmallVector<std::string, 2> moved(std::move(copy));
+  CHECK(moved.data() == data);
+  CheckValues(moved, 5);
+  CHECK(copy.empty());
+  CHECK(IsInline(copy));
+
+  SmallVector<std::string, 2> move_assigned = MakeVector<2>(4);
+  move_assigned = std::move(moved);
+  CHECK(move_assigned.data() == data);
+  CheckValues(move_assigned, 5);
+  CHECK(moved.empty());
+
+  // A moved from vector can be used again.
+  moved.push_back(Value(0));
+  CheckValues(moved, 1);
+}
+
+TEST_CASE("SmallVector copy-assigns heap elements over inline ones and back", "[small-vector][unit]") {
+  auto heap = MakeVector<2>(5);
+  auto small = MakeVector<2>(1);
+  REQUIRE(IsInline(small));
+
+  small = heap;
+  CHECK_FALSE(IsInline(small));
+  CheckValues(small, 5);
+
+  // Fewer elements than the heap capacity are copied into it.
+  auto const two = MakeVector<2>(2);
+  small = two;
+  CHECK_FALSE(IsInline(small));
+  CheckValues(small, 2);
+
+  auto inline_target = MakeVector<2>(2);
+  inline_target = heap;
+  CheckValues(inline_target, 5);
+
+  // Self assignment.
+  auto& self = inline_target;
+  inline_target = self;
+  CheckValues(inline_target, 5);
+}
+
+TEST_CASE("SmallVector destroys its elements and frees its heap storage", "[small-vector][unit]") {
+  auto counter = std::make_shared<int>(0);
+  {
+    SmallVector<std::shared_ptr<int>, 2> vector;
+    for (int i = 0; i < 5; ++i)
+      vector.push_back(counter);
+    CHECK(counter.use_count() == 6);
+
+    vector = SmallVector<std::shared_ptr<int>, 2>();
+    CHECK(counter.use_count() == 1);
+    CHECK(vector.capacity() == 2);
+
+    vector.push_back(counter);
+    CHECK(counter.use_count() == 2);
+  }
+  CHECK(counter.use_count() == 1);
+}
+
+TEST_CASE("SmallVector emplaces elements that refer to its own elements", "[small-vector][unit]") {
+  auto vector = MakeVector<4>(4);
+  REQUIRE(vector.size() == vector.capacity());
+  // Reallocates, the argument must be copied before the old elements are moved from.
+  vector.emplace_back(vector[0]);
+  CHECK(vector.back() == Value(0));
+  CHECK(vector[0] == Value(0));
+
+  while (vector.size() < vector.capacity())
+    vector.push_back(Value(0));
+  vector.push_back(vector.back());
+  CHECK(vector.back() == Value(0));
+  CHECK(vector[vector.size() - 2] == Value(0));
+}
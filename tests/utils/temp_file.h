@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+// File in the temp directory that is removed when the test ends.
+class TempFile {
+ public:
+  TempFile(const std::string& name) : path_(std::filesystem::temp_directory_path() / name) {
+    std::filesystem::remove(path_);
+  }
+  ~TempFile() {
+    std::error_code ec;
+    std::filesystem::remove(path_, ec);
+  }
+
+  const std::filesystem::path& path() const { return path_; }
+
+ private:
+  std::filesystem::path path_;
+};
@@ -21,7 +21,8 @@ void TestBlocksDevice::WriteBlock(uint32_t block_number,
                                   const std::span<std::byte>& /*hash*/,
                                   uint32_t /*iv*/,
                                   bool /*encrypt*/,
-                                  bool /*recalculate_hash*/) {
+                                  bool /*recalculate_hash*/,
+                                  uint32_t /*dirty_offset*/) {
   // if (recalculate_hash)
   //   DeviceEncryption::CalculateHash(data, hash);
   blocks_[block_number] = {data.begin(), data.end()};
@@ -44,3 +45,33 @@ bool TestBlocksDevice::ReadBlock(uint32_t block_number,
   // return !check_hash || DeviceEncryption::CheckHash(data, hash);
   return true;
 }
+
+void TestBlocksDevice::WriteBlocks(std::span<const BlockWrite> blocks) {
+  for (const auto& block : blocks)
+    WriteBlock(block.block_number, /*size_in_blocks=*/0, block.data, block.hash, block.iv, block.encrypt,
+               block.recalculate_hash, block.dirty_offset);
+}
+
+std::vector<bool> TestBlocksDevice::ReadBlocks(std::span<const BlockRead> blocks) {
+  std::vector<bool> results;
+  for (const auto& block : blocks)
+    results.push_back(ReadBlock(block.block_number, /*size_in_blocks=*/0, block.data, block.hash, block.iv,
+                                block.encrypt, block.check_hash));
+  return results;
+}
+
+void TestBlocksDevice::ReadBlockRange(uint32_t block_number,
+                                      uint32_t /*block_size*/,
+                                      uint32_t offset,
+                                      const std::span<std::byte>& data,
+                                      uint32_t /*iv*/,
+                                      bool /*encrypt*/) {
+  ++block_range_reads_;
+  auto it = blocks_.find(block_number);
+  if (it != blocks_.end()) {
+    assert(offset + data.size() <= it->second.size());
+    std::memcpy(data.data(), it->second.data() + offset, data.size());
+  } else {
+    std::ranges::fill(data, std::byte{0});
+  }
+}
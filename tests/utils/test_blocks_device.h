@@ -22,7 +22,8 @@ class TestBlocksDevice : public BlocksDevice {
                   const std::span<std::byte>& hash,
                   uint32_t iv,
                   bool encrypt,
-                  bool recalculate_hash) override;
+                  bool recalculate_hash,
+                  uint32_t dirty_offset) override;
 
   bool ReadBlock(uint32_t block_number,
                  uint32_t size_in_blocks,
@@ -32,6 +33,16 @@ class TestBlocksDevice : public BlocksDevice {
                  bool encrypt,
                  bool check_hash) override;
 
+  void WriteBlocks(std::span<const BlockWrite> blocks) override;
+  std::vector<bool> ReadBlocks(std::span<const BlockRead> blocks) override;
+  void ReadBlockRange(uint32_t block_number,
+                      uint32_t block_size,
+                      uint32_t offset,
+                      const std::span<std::byte>& data,
+                      uint32_t iv,
+                      bool encrypt) override;
+
  public:
   std::map<uint32_t, std::vector<std::byte>> blocks_;
+  size_t block_range_reads_{0};
 };
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 koolkdev
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#pragma once
+
+#include <wfslib/device.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// Device that keeps its sectors in memory and can expose them as views.
+class TestMemoryDevice : public Device {
+ public:
+  TestMemoryDevice(uint32_t sectors_count, bool mappable = true)
+      : data_(size_t{sectors_count} << 9), sectors_count_(sectors_count), log2_sector_size_(9), mappable_(mappable) {}
+  ~TestMemoryDevice() override = default;
+
+  void ReadSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) override {
+    auto sectors = GetSectors(sector_address, sectors_count);
+    std::ranges::copy(sectors, data.begin());
+    ++reads_count;
+    read_bytes += data.size();
+  }
+  void WriteSectors(const std::span<std::byte>& data, uint32_t sector_address, uint32_t sectors_count) override {
+    std::ranges::copy(data, GetSectors(sector_address, sectors_count).begin());
+    ++writes_count;
+    written_bytes += data.size();
+  }
+  void ReadSectorsBatch(std::span<const SectorsRange> ranges) override {
+    Device::ReadSectorsBatch(ranges);
+    ++read_batches_count;
+  }
+  uint32_t SectorsCount() const override { return sectors_count_; }
+  uint32_t Log2SectorSize() const override { return log2_sector_size_; }
+  bool IsReadOnly() const override { return false; }
+  void SetSectorsCount(uint32_t sectors_count) override { sectors_count_ = sectors_count; }
+  void SetLog2SectorSize(uint32_t log2_sector_size) override { log2_sector_size_ = log2_sector_size; }
+
+  std::span<const std::byte> SectorsView(uint32_t sector_address, uint32_t sectors_count) const override {
+    if (!mappable_)
+      return {};
+    return const_cast<TestMemoryDevice*>(this)->GetSectors(sector_address, sectors_count);
+  }
+
+  std::span<std::byte> GetSectors(uint32_t sector_address, uint32_t sectors_count) {
+    return std::span{data_}.subspan(size_t{sector_address} << log2_sector_size_,
+                                    size_t{sectors_count} << log2_sector_size_);
+  }
+
+  // Atomic, sectors may be read from several threads.
+  std::atomic<size_t> reads_count{0};
+  std::atomic<size_t> read_bytes{0};
+  std::atomic<size_t> writes_count{0};
+  std::atomic<size_t> written_bytes{0};
+  std::atomic<size_t> read_batches_count{0};
+
+ private:
+  std::vector<std::byte> data_;
+  uint32_t sectors_count_;
+  uint32_t log2_sector_size_;
+  bool mappable_;
+};